@@ -5,7 +5,8 @@
 
 namespace jup {
 
-void Mothership_complex::init(Graph* graph_) {
+template <int N>
+void Mothership_team<N>::init(Graph* graph_) {
     graph = graph_;
     world_buffer.reset();
     sit_buffer.reset();
@@ -13,48 +14,85 @@ void Mothership_complex::init(Graph* graph_) {
     strategies.reset();
     strategies.reserve(max_strategy_count);
     strategies_guard = strategies.m_data.alloc_guard();
+    warm_strategies.reset();
     sim_state.dist_cache.facility_count = 0; // Dirty hack to reinitialise dist_cache
 }
 
-void Mothership_complex::on_sim_start(u8 agent, Simulation const& simulation, int sim_size) {
+template <int N>
+void Mothership_team<N>::on_sim_start(u8 agent, Simulation const& simulation, int sim_size) {
     if (agent == 0) {
         world_buffer.emplace_back<World>(simulation, graph, &world_buffer);
     }
     world().update(simulation, agent, &world_buffer);
 }
 
-void Mothership_complex::pre_request_action() {
+template <int N>
+void Mothership_team<N>::pre_request_action() {
     std::swap(sit_buffer, sit_old_buffer);
     sit_buffer.reset();
 }
 
-void Mothership_complex::pre_request_action(u8 agent, Percept const& perc, int perc_size) {
+template <int N>
+void Mothership_team<N>::pre_request_action(u8 agent, Percept const& perc, int perc_size) {
     if (agent == 0) {
-        Situation* old = sit_old_buffer.size() ? &sit_old_buffer.get<Situation>() : nullptr;
-        sit_buffer.emplace_back<Situation>(perc, old, &sit_buffer);
+        Situation<N>* old = sit_old_buffer.size() ? &sit_old_buffer.get<Situation<N>>() : nullptr;
+        sit_buffer.emplace_back<Situation<N>>(perc, old, &sit_buffer);
 
         // This actually only invalidates the world in the first step, unless step_init changes
         world().step_init(perc, &world_buffer);
-        deadline = elapsed_time() + deadline_offset;
     }
+    deadline_control.on_percept(agent, perc);
     
     sit().update(perc, agent, &sit_buffer);
     world().step_update(perc, agent, &world_buffer);
 }
 
-void Mothership_complex::on_request_action() {
-    auto strategy_gen_id = [this](Strategy_slot& s) {
-        s.strategy.parent = s.strategy.s_id;
-        s.strategy.s_id = ++strategy_next_id;
+template <int N>
+void Mothership_team<N>::on_request_action() {
+    auto strategy_gen_id = [this](Strategy<N>& s) {
+        s.parent = s.s_id;
+        s.s_id = ++strategy_next_id;
     };
     
     world().step_post(&world_buffer);
+    deadline_control.on_percepts_done();
+    if (capture and *capture) {
+        capture->write_step(world_buffer, sit_buffer, sit_old_buffer);
+    }
+
+    search_stats = Search_stats {};
+    double time_last = elapsed_time();
+    double time_begin = time_last;
+    auto time_phase = [&time_last](double* into) {
+        double now = elapsed_time();
+        *into += now - time_last;
+        time_last = now;
+    };
+    
+    Situation<N>* old = sit_old_buffer.size() ? &sit_old_buffer.get<Situation<N>>() : nullptr;
+    
+    // Bring the strategies carried over from the last step up to date. This has to happen before
+    // sit() is flushed, as flush_old only works once.
+    if (old) {
+        for (auto& i: warm_strategies) {
+            sim_buffer.reset();
+            sim_buffer.append(sit_buffer);
+            auto& s = sim_buffer.get<Situation<N>>();
+            std::memcpy(&s.strategy, &i.strategy, sizeof(Strategy<N>));
+            warm_diff.init(&sim_buffer);
+            s.register_arr(&warm_diff);
+            s.flush_old(world(), *old, &warm_diff);
+            warm_diff.apply();
+            std::memcpy(&i.strategy, &s.strategy, sizeof(Strategy<N>));
+        }
+    } else {
+        warm_strategies.reset();
+    }
     
     sit_diff.init(&sit_buffer);
     sit().register_arr(&sit_diff);
     
     // Flush all the old tasks out
-    Situation* old = sit_old_buffer.size() ? &sit_old_buffer.get<Situation>() : nullptr;
     sit().flush_old(world(), *old, &sit_diff);
     sit_diff.apply();
 
@@ -64,52 +102,79 @@ void Mothership_complex::on_request_action() {
     sim_state.init(&world(), &sim_buffer, 0, sim_buffer.size());
 
     strategies.reset();
+    strategy_store.reset();
     strategies.emplace_back();
-    std::memcpy(&strategies[0].strategy, &sim_state.orig().strategy, sizeof(Strategy));
+    strategy_scratch = sim_state.orig().strategy;
+    strategy_gen_id(strategy_scratch);
+    strategies[0].stored = strategy_store.add(strategy_scratch);
+    time_phase(&search_stats.prepare);
     strategies[0].rating = sim_state.rate();
     strategies[0].rating_sum = strategies[0].rating;
     strategies[0].visited = 1;
-    strategy_gen_id(strategies[0]);
+    time_phase(&search_stats.rate);
+
+    // Seed the search with the last step's best strategies. They keep their old rating as a prior
+    // and get rated properly once they are selected.
+    for (auto const& i: warm_strategies) {
+        if (i.strategy == strategy_scratch) continue;
+        strategies.emplace_back();
+        strategies.back().stored = strategy_store.add(i.strategy);
+        strategies.back().rating = i.rating;
+        strategies.back().visited = 1;
+        strategies.back().rating_sum = i.rating;
+        strategies.back().flags = Strategy_slot::WARM;
+        add_child(0, strategies.size() - 1);
+    }
+
+    double deadline = deadline_control.search_deadline();
+    for (int iteration = 0; strategies.size() < max_strategy_count; ++iteration) {
+        if (search_iterations ? iteration >= search_iterations : elapsed_time() >= deadline) break;
 
-    while (elapsed_time() < deadline and strategies.size() < max_strategy_count) {
         // Choose the strategy to explore
-        int best_arg = 0;
-        float best_value = 0;
-        for (int i_it = 0; i_it < strategies.size(); ++i_it) {
-            auto const& i = strategies[i_it];
-            float value = i.rating_sum / i.visited / search_rating_max;
-            value += search_exploration * std::sqrt(2*std::log(strategies.size()) / i.visited);
-            if (value > best_value) {
-                best_arg = i_it;
-                best_value = value;
-            }
+        int best_arg = search_mode == Server_options::SEARCH_TREE ? select_tree() : select_flat();
+
+        if (strategies[best_arg].flags & Strategy_slot::WARM) {
+            strategy_store.get(strategies[best_arg].stored, &sim_state.orig().strategy);
+            strategies[best_arg].rating = sim_state.rate();
+            strategies[best_arg].rating_sum = strategies[best_arg].rating;
+            strategies[best_arg].flags = 0;
+            time_phase(&search_stats.rate);
+            continue;
         }
 
         // Explore
-        std::memcpy(&sim_state.orig().strategy, &strategies[best_arg].strategy, sizeof(Strategy));
+        strategy_store.get(strategies[best_arg].stored, &strategy_scratch);
+        sim_state.orig().strategy = strategy_scratch;
         sim_state.reset();
         sim_state.fast_forward();
+        time_phase(&search_stats.fast_forward);
         bool cw = sim_state.create_work();
+        time_phase(&search_stats.create_work);
         bool fe = sim_state.fix_errors();
+        time_phase(&search_stats.fix_errors);
         bool op = sim_state.optimize();
+        time_phase(&search_stats.optimize);
 
-        if (sim_state.orig().strategy == strategies[best_arg].strategy) {
-            strategies[best_arg].rating_sum += strategies[best_arg].rating;
-            strategies[best_arg].visited += 1;
+        if (sim_state.orig().strategy == strategy_scratch) {
+            backpropagate(best_arg, strategies[best_arg].rating);
         } else {
             int index = strategies.size();
             strategies.emplace_back();
-            std::memcpy(&strategies[index].strategy, &sim_state.orig().strategy, sizeof(Strategy));
+            strategy_gen_id(sim_state.orig().strategy);
+            strategies[index].stored = strategy_store.add(sim_state.orig().strategy,
+                strategies[best_arg].stored, &strategy_scratch);
             strategies[index].rating = sim_state.rate();
             strategies[index].rating_sum = strategies[index].rating;
             strategies[index].visited = 1;
-            strategies[index].flags = cw | (fe << 1) | (op << 2);
-            strategy_gen_id(strategies[index]);
-        
-            strategies[best_arg].rating_sum += strategies[index].rating;
-            strategies[best_arg].visited += 1;
+            strategies[index].flags = (cw ? Strategy_slot::CREATE_WORK : 0)
+                | (fe ? Strategy_slot::FIX_ERRORS : 0) | (op ? Strategy_slot::OPTIMIZE : 0);
+            add_child(best_arg, index);
+            backpropagate(best_arg, strategies[index].rating);
         }
+        time_phase(&search_stats.rate);
     }
+    // The rest until the actions are sent is overhead, which the search deadline leaves room for
+    deadline_control.on_search_done();
 
     // Choose the best strategy
     int best_arg = 0;
@@ -118,21 +183,43 @@ void Mothership_complex::on_request_action() {
         auto const& i = strategies[i_it];
         JDBG_L < i.visited < i.flags < i.rating < i.rating_sum / i.visited / search_rating_max < search_exploration
             * std::sqrt(2*std::log(strategies.size()) / i.visited) ,0;
+        if (i.flags & Strategy_slot::WARM) continue;
         if (i.rating > best_value) {
             best_arg = i_it;
             best_value = i.rating;
         }
     }
-    
-    std::memcpy(&sit().strategy, &strategies[best_arg].strategy, sizeof(Strategy));
 
-    std::memcpy(&sim_state.orig().strategy, &strategies[best_arg].strategy, sizeof(Strategy));
+    // Remember the best ones for the next step
+    warm_order.reset();
+    for (int i = 0; i < strategies.size(); ++i) {
+        if (i == best_arg or strategies[i].flags & Strategy_slot::WARM) continue;
+        warm_order.push_back(i);
+    }
+    int warm_count = std::min(warm_start_count, warm_order.size());
+    std::partial_sort(warm_order.begin(), warm_order.begin() + warm_count, warm_order.end(),
+        [this](int a, int b) { return strategies[a].rating > strategies[b].rating; });
+    warm_strategies.resize(warm_count);
+    for (int i = 0; i < warm_count; ++i) {
+        strategy_store.get(strategies[warm_order[i]].stored, &warm_strategies[i].strategy);
+        warm_strategies[i].rating = strategies[warm_order[i]].rating;
+    }
+
+    search_stats.total = elapsed_time() - time_begin;
+    search_stats.strategies = strategies.size();
+    search_stats.strategy_bytes = strategy_store.bytes() + strategies.size() * sizeof(Strategy_slot);
+    search_stats.best_rating = best_value;
+    
+    strategy_store.get(strategies[best_arg].stored, &sim_state.orig().strategy);
+    sit().strategy = sim_state.orig().strategy;
     sim_state.reset();
     sim_state.fast_forward();
     JDBG_L < sim_state.sit().strategy.p_results() ,1;
     JDBG_L < sim_state.orig().strategy.p_tasks() ,0;
 
-    jout << "Searched " << strategies.size() << " strategies, with max " << best_value << endl;
+    jout << "Searched " << strategies.size() << " strategies, with max " << best_value
+         << ", missed deadlines " << deadline_control.missed_local << '/'
+         << deadline_control.missed_server << endl;
     
     std::memcpy(&sit().strategy, &sim_state.sit().strategy, sizeof(sit().strategy));
 
@@ -160,7 +247,7 @@ void Mothership_complex::on_request_action() {
         sim_state.fast_forward(sit().simulation_step);
 
         // These are just to make the output easier on the eyes
-        for (u8 agent = 0; agent < number_of_agents; ++agent) {
+        for (u8 agent = 0; agent < N; ++agent) {
             sim_state.sit().self(agent).action_type = sit().self(agent).action_type;
             sim_state.sit().self(agent).action_result = sit().self(agent).action_result;
             sim_state.sit().self(agent).task_sleep = sit().self(agent).task_sleep;
@@ -179,7 +266,7 @@ void Mothership_complex::on_request_action() {
         die(false);
         }*/
     /*
-    for (u8 agent = 0; agent < number_of_agents; ++agent) {
+    for (u8 agent = 0; agent < N; ++agent) {
         for (u8 i = 0; i < planning_max_tasks; ++i) {
             auto const& t = sim_state.orig().strategy.task(agent, i).task;
             auto const& r = sim_state.sit().strategy.task(agent, i).result;
@@ -193,10 +280,201 @@ void Mothership_complex::on_request_action() {
         }*/
 }
 
-void Mothership_complex::post_request_action(u8 agent, Buffer* into) {
-    Situation* old = sit().simulation_step == 0 ? &sit() : &sit_old();
+template <int N>
+int Mothership_team<N>::select_flat() {
+    int best_arg = 0;
+    float best_value = 0;
+    for (int i_it = 0; i_it < strategies.size(); ++i_it) {
+        auto const& i = strategies[i_it];
+        float value = i.rating_sum / i.visited / search_rating_max;
+        value += search_exploration * std::sqrt(2*std::log(strategies.size()) / i.visited);
+        if (value > best_value) {
+            best_arg = i_it;
+            best_value = value;
+        }
+    }
+    return best_arg;
+}
+
+template <int N>
+int Mothership_team<N>::select_tree() {
+    int node = 0;
+    while (true) {
+        auto const& n = strategies[node];
+        // Progressive widening: a node gets another child once it was visited often enough
+        if (n.children < search_widening_factor * std::pow((float)n.visited, search_widening_exponent)) {
+            return node;
+        }
+
+        int best_arg = n.first_child;
+        float best_value = 0;
+        for (int i_it = n.first_child; i_it != -1; i_it = strategies[i_it].next_sibling) {
+            auto const& i = strategies[i_it];
+            float value = i.rating_sum / i.visited / search_rating_max;
+            value += search_exploration * std::sqrt(2*std::log(n.visited) / i.visited);
+            if (value > best_value) {
+                best_arg = i_it;
+                best_value = value;
+            }
+        }
+        // The carried strategies are rated as soon as they are reached
+        if (strategies[best_arg].flags & Strategy_slot::WARM) return best_arg;
+        node = best_arg;
+    }
+}
+
+template <int N>
+void Mothership_team<N>::add_child(int parent, int child) {
+    auto& p = strategies[parent];
+    auto& c = strategies[child];
+    c.parent = parent;
+    c.next_sibling = p.first_child;
+    p.first_child = child;
+    ++p.children;
+}
+
+template <int N>
+void Mothership_team<N>::backpropagate(int node, float rating) {
+    if (search_mode == Server_options::SEARCH_TREE) {
+        for (int i = node; i != -1; i = strategies[i].parent) {
+            strategies[i].rating_sum += rating;
+            strategies[i].visited += 1;
+        }
+    } else {
+        strategies[node].rating_sum += rating;
+        strategies[node].visited += 1;
+    }
+}
+
+template <int N>
+void Mothership_team<N>::post_request_action(u8 agent, Buffer* into) {
+    Situation<N>* old = sit().simulation_step == 0 ? &sit() : &sit_old();
     sit().get_action(world(), *old, agent, crafting_plan.slot(agent), &auction_bets, into);
 }
 
+template <int N>
+void Mothership_team<N>::on_actions_sent() {
+    deadline_control.on_actions_sent();
+}
+
+template struct Mothership_team<16>;
+template struct Mothership_team<20>;
+template struct Mothership_team<28>;
+
+void Mothership_complex::init(Graph* graph_) {
+    graph = graph_;
+    if (capture) {
+        capture.write(Capture_writer::MAP, graph->name());
+    }
+    sim_start_buffer.reset();
+    sim_start_agents.reset();
+    sim_start_offsets.reset();
+    team.reset();
+}
+
+void Mothership_complex::on_sim_start(u8 agent, Simulation const& simulation, int sim_size) {
+    sim_start_agents.push_back(agent);
+    sim_start_offsets.push_back(sim_start_buffer.size());
+    sim_start_buffer.append(Buffer_view {(char const*)&simulation, sim_size});
+}
+
+template <int N>
+void Mothership_complex::start_team() {
+    auto result = std::make_unique<Mothership_team<N>>();
+    result->search_iterations = search_iterations;
+    result->search_mode = search_mode;
+    result->capture = &capture;
+    if (capture) {
+        u32 size = N;
+        capture.write(Capture_writer::TEAM, Buffer_view {(char const*)&size, sizeof(size)});
+    }
+    result->init(graph);
+    for (int i = 0; i < sim_start_agents.size(); ++i) {
+        auto const& simulation = sim_start_buffer.get<Simulation>(sim_start_offsets[i]);
+        int sim_size = (i + 1 < sim_start_offsets.size() ? sim_start_offsets[i + 1]
+            : sim_start_buffer.size()) - sim_start_offsets[i];
+        result->on_sim_start(sim_start_agents[i], simulation, sim_size);
+    }
+    team = std::move(result);
+}
+
+void Mothership_complex::pre_request_action() {
+    if (not team) {
+        int agents = 0;
+        for (u8 i: sim_start_agents) agents = std::max(agents, i + 1);
+        switch (team_size_for(agents)) {
+        case 16: start_team<16>(); break;
+        case 20: start_team<20>(); break;
+        case 28: start_team<28>(); break;
+        default:
+            jerr << "Error: Teams of more than " << number_of_agents << " agents are not supported, got "
+                 << agents << '\n';
+            die(false);
+        }
+        jout << "Planning for a team of " << agents << " agents\n";
+    }
+    team->pre_request_action();
+}
+
+void Mothership_complex::pre_request_action(u8 agent, Percept const& perc, int perc_size) {
+    team->pre_request_action(agent, perc, perc_size);
+}
+
+void Mothership_complex::on_request_action() {
+    team->on_request_action();
+}
+
+void Mothership_complex::post_request_action(u8 agent, Buffer* into) {
+    team->post_request_action(agent, into);
+}
+
+void Mothership_complex::on_actions_sent() {
+    team->on_actions_sent();
+}
+
+void Deadline_control::on_percept(u8 agent, Percept const& perc) {
+    double now = elapsed_time();
+    if (agent == 0) {
+        step_begin = now;
+        missed_step = false;
+        if (perc.timestamp) {
+            offset = std::min(offset, now - perc.timestamp / 1000.0);
+        }
+        server_deadline = perc.deadline and perc.timestamp ? perc.deadline / 1000.0 + offset : 0;
+    }
+    // We always send an action, so noAction means that it arrived too late
+    if (perc.simulation_step > 0 and perc.self.action_type == Action::NO_ACTION) {
+        missed_step = true;
+    }
+}
+
+void Deadline_control::on_percepts_done() {
+    if (missed_step) {
+        ++missed_server;
+        margin = std::min(margin * 2.f, deadline_margin_max);
+    } else {
+        margin = std::max(margin * deadline_decay, deadline_margin_min);
+    }
+}
+
+double Deadline_control::search_deadline() const {
+    if (server_deadline == 0) return step_begin + deadline_offset;
+    // The time to read the percepts is part of the offset, as that is measured once they are read
+    return server_deadline - overhead_send - margin;
+}
+
+void Deadline_control::on_search_done() {
+    search_end = elapsed_time();
+}
+
+void Deadline_control::on_actions_sent() {
+    double now = elapsed_time();
+    overhead_send = std::max((float)(now - search_end), overhead_send * deadline_decay);
+    if (server_deadline != 0 and now > server_deadline) {
+        ++missed_local;
+    }
+    ++steps;
+}
+
 
 } /* end of namespace jup */
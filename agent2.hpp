@@ -4,6 +4,7 @@
 #include "objects.hpp"
 #include "server.hpp"
 #include "simulation.hpp"
+#include "replay.hpp"
 
 namespace jup {
 
@@ -11,43 +12,174 @@ constexpr int max_strategy_count = 2048;
 
 constexpr float search_rating_max  = 5e5;
 constexpr float search_exploration = 0.005f;
+// In the tree search, a strategy visited n times may have factor * n^exponent children
+constexpr float search_widening_factor   = 1.f;
+constexpr float search_widening_exponent = 0.5f;
 
+// Search time used if the server does not provide a deadline
 constexpr float deadline_offset = 2.f;
+// Minimum time kept in reserve before the deadline, and the maximum it may grow to after misses
+constexpr float deadline_margin_min = 0.1f;
+constexpr float deadline_margin_max = 1.f;
+// Factor by which measured overheads and the margin fall back per step
+constexpr float deadline_decay = 0.95f;
+
+// Number of strategies carried over into the search of the next step
+constexpr int warm_start_count = 32;
 
 struct Strategy_slot {
-    Strategy strategy;
+    enum Flags: u8 {
+        CREATE_WORK = 1, FIX_ERRORS = 2, OPTIMIZE = 4,
+        WARM = 8 // Carried over from the last step, rating is from then
+    };
+    
+    int stored = -1; // Index of the strategy in Mothership_team::strategy_store
+    // The strategy this one was created from and the ones created from it, as indices. The carried
+    // strategies are children of the first one.
+    int parent = -1;
+    int first_child = -1;
+    int next_sibling = -1;
+    int children = 0;
     float rating = 0.f;
     int visited = 0;
     float rating_sum = 0.f; // Sum of own and children's ratings
     u8 flags = 0;
 };
 
-struct Mothership_complex : Mothership {    
+// A strategy carried over into the search of the next step
+template <int N>
+struct Warm_strategy {
+    Strategy<N> strategy;
+    float rating;
+};
+
+/**
+ * Decides how long the search may run. The deadline in the percept is mapped to local time via
+ * the smallest observed difference between local time and the server timestamps (which includes
+ * the network latency, so it is slightly late). From that, the time needed to generate and send
+ * the actions and a safety margin are subtracted. The margin grows whenever the server reports
+ * that it did not receive our actions in time.
+ */
+struct Deadline_control {
+    double offset = std::numeric_limits<double>::infinity();
+    double step_begin = 0;      // Local time the first percept of this step arrived
+    double search_end = 0;      // Local time the search loop finished
+    double server_deadline = 0; // Local time of the server's deadline, 0 if unknown
+    float overhead_send = 0.f;     // Time from search_end until all actions are sent
+    float margin = deadline_margin_min;
+    bool missed_step = false;
+
+    int steps = 0;
+    int missed_local = 0;  // Actions sent after our estimate of the deadline
+    int missed_server = 0; // Steps where the server reported noAction for one of our agents
+
+    void on_percept(u8 agent, Percept const& perc);
+    void on_percepts_done();
+    double search_deadline() const;
+    void on_search_done();
+    void on_actions_sent();
+};
+
+// Where the time of one search went, in seconds
+struct Search_stats {
+    double prepare = 0;      // Flushing the old situation and the carried strategies
+    double fast_forward = 0;
+    double create_work = 0;
+    double fix_errors = 0;
+    double optimize = 0;
+    double rate = 0;
+    double total = 0;
+    int strategies = 0;
+    int strategy_bytes = 0;  // Memory used for the strategies of the search
+    float best_rating = 0;
+};
+
+// The search for a team of N agents, see team_sizes
+template <int N>
+struct Mothership_team : Mothership {
 	void init(Graph* graph) override;
 	void on_sim_start(u8 agent, Simulation const& simulation, int sim_size) override;
 	void pre_request_action() override;
 	void pre_request_action(u8 agent, Percept const& perc, int perc_size) override;
 	void on_request_action() override;
 	void post_request_action(u8 agent, Buffer* into) override;
+	void on_actions_sent() override;
+
+    // Choose the strategy to explore next. The flat search considers all strategies, the tree
+    // search descends from the first one, using progressive widening.
+    int select_flat();
+    int select_tree();
+    void add_child(int parent, int child);
+    // Account for a rating found below the node, only the node itself in the flat search, the
+    // whole path up to the first strategy in the tree search
+    void backpropagate(int node, float rating);
 
     auto& world() { return world_buffer.get<World>(0); }
-    auto& sit() { return sit_buffer.get<Situation>(0); }
-    auto& sit_old() { return sit_old_buffer.get<Situation>(0); }
+    auto& sit() { return sit_buffer.get<Situation<N>>(0); }
+    auto& sit_old() { return sit_old_buffer.get<Situation<N>>(0); }
     
     Buffer world_buffer;
     Buffer sit_buffer;
     Buffer sit_old_buffer;
     Buffer sim_buffer;
-    Simulation_state sim_state;
+    Simulation_state<N> sim_state;
     Diff_flat_arrays sit_diff;
     Graph* graph;
-    Crafting_plan crafting_plan;
+    Crafting_plan<N> crafting_plan;
     Array<Auction_bet> auction_bets;
-    double deadline = 0;
+    Deadline_control deadline_control;
+    Search_stats search_stats;
+
+    // If nonzero, the search runs for this many iterations and ignores the deadline
+    int search_iterations = 0;
+    u8 search_mode = Server_options::SEARCH_FLAT;
+
+    // If set and open, the inputs of each on_request_action are written into it, see replay.hpp
+    Capture_writer* capture = nullptr;
 
     u32 strategy_next_id = 0;
     Array<Strategy_slot> strategies;
     Buffer_guard strategies_guard;
+    // The strategies of the search, the children relative to the strategy they were created from
+    Strategy_store<N> strategy_store;
+    Strategy<N> strategy_scratch;
+
+    // The best strategies of the last step, still relative to sit_old
+    Array<Warm_strategy<N>> warm_strategies;
+    Array<int> warm_order;
+    Diff_flat_arrays warm_diff;
+};
+
+extern template struct Mothership_team<16>;
+extern template struct Mothership_team<20>;
+extern template struct Mothership_team<28>;
+
+/**
+ * Runs the Mothership_team for the size of our team. The number of agents is only known once all
+ * the Sim_start messages have arrived, so these are kept and passed on in the first step.
+ */
+struct Mothership_complex : Mothership {
+	void init(Graph* graph) override;
+	void on_sim_start(u8 agent, Simulation const& simulation, int sim_size) override;
+	void pre_request_action() override;
+	void pre_request_action(u8 agent, Percept const& perc, int perc_size) override;
+	void on_request_action() override;
+	void post_request_action(u8 agent, Buffer* into) override;
+	void on_actions_sent() override;
+
+    template <int N>
+    void start_team();
+
+    Graph* graph = nullptr;
+    Buffer sim_start_buffer;
+    Array<u8> sim_start_agents;
+    Array<int> sim_start_offsets; // Offset of the Simulation of each agent in sim_start_buffer
+    std::unique_ptr<Mothership> team;
+
+    // Passed on to the Mothership_team
+    int search_iterations = 0;
+    u8 search_mode = Server_options::SEARCH_FLAT;
+    Capture_writer capture;
 };
 
 
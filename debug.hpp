@@ -484,6 +484,14 @@ void jdbg_diff(T const& a, T const& b) {
     dodiff_obj(type, __VA_ARGS__)                                       \
     print_for_gdb(type)
 
+// Same as op, for the templates over the team size (see team_sizes)
+#define op_sized(type, ...)                                             \
+    template <int N> display_obj(type<N>, __VA_ARGS__)                  \
+    template <int N> dodiff_obj(type<N>, __VA_ARGS__)                   \
+    print_for_gdb(type<16>)                                             \
+    print_for_gdb(type<20>)                                             \
+    print_for_gdb(type<28>)
+
 #define hex(x) (x, make_hex)
 #define repr(x) (x, Repr)
 #define id(x) (x, Id_string)
@@ -518,24 +526,25 @@ op(Auction, id16(id), storage, start, end, required, reward, fine)
 //op(Mission, id16(id), storage, start, end, required, reward, fine, max_bid)
 op(Posted, id16(id), storage, start, end, required, reward)
 op(Resource_node, id(name), resource, pos)
-op(Percept, deadline, id, simulation_step, team_money, self, entities, charging_stations, dumps,
+op(Percept, deadline, timestamp, id, simulation_step, team_money, self, entities, charging_stations, dumps,
     shops, storages, workshops, resource_nodes, auctions, jobs, missions, posteds)
 
 op(Task, type, id(where), id, item, job_id, cnt, fixer_it)
 op(Task_result, time, err, err_arg)
 op(Shop_limit, id(shop), item)
 op(Item_cost, id(id), count, sum)
-op(World, team, seed_capital, steps, items, roles, graph, shop_limits, item_costs)
+op(Recipe, id(id), depth)
+op(World, team, seed_capital, steps, items, roles, graph, recipes, shop_limits, item_costs)
 op(Job_item, id16(job_id), item)
 op(Bookkeeping, delivered)
 op(Task_slot, task, result)
 op(Auction_bet, job_id, bet)
-op(Strategy, m_tasks)
+op_sized(Strategy, m_tasks)
 op(Crafting_slot, type, agent, item, extra_load)
-op(Crafting_plan, slots)
+op_sized(Crafting_plan, slots)
 op(Self_sim, id(name), team, pos, role, charge, load, id(facility), action_name(action_type),
     action_result_name(action_result), task_index, task_state, task_sleep, items)
-op(Situation, simulation_step, team_money, selves, entities, charging_stations, dumps, shops,
+op_sized(Situation, simulation_step, team_money, selves, entities, charging_stations, dumps, shops,
     storages, workshops, resource_nodes, auctions, jobs, missions, posteds, strategy, book)
 
 display_obj(Graph_position, id, edge_pos)
@@ -566,6 +575,7 @@ op(World, simulation_id, team_id, opponent_team, seed_capital,
 	dumps, shops, storages, workshops)*/
 
 #undef op
+#undef op_sized
 #undef display_obj
 #undef display_var
 #undef display_var1
@@ -500,9 +500,27 @@ struct Diff_flat_arrays_base {
         ADD, REMOVE, REMOVE_IGNORE
     };
 
+    // A change of the container, used by apply
+    struct Batch_edit {
+        int pos;   // Position in the container before applying
+        int src;   // Offset of the element to insert in diffs, or -1 for a removal
+        int shift; // Total change in size up to and including this one
+        u16 seq;   // Position in the queue
+        u8 ref;
+        u8 len;
+    };
+    // The position of the size of a registered array and its change, used by apply
+    struct Batch_ref {
+        int data;
+        int delta;
+    };
+
     Buffer* container = nullptr;
     Buffer diffs;
     int _first;
+    Buffer batch_edits;
+    Buffer batch_refs;
+    Buffer batch_tail;
 
     Diff_flat_arrays_base() {}
     Diff_flat_arrays_base(Buffer* container) { init(container); }
@@ -583,9 +601,7 @@ struct Diff_flat_arrays_base {
     Flat_array<Flat_array_ref> const& refs() const { return diffs.get<Flat_array<Flat_array_ref>>(); }
     Flat_array<Flat_array_ref>&       refs()       { return diffs.get<Flat_array<Flat_array_ref>>(); }
 
-    void apply() {
-        if (not first()) return;
-        
+    void check_refs() const {
         assert(container);
         for (auto& i: refs()) {
             assert(container->inside(container->begin() + i.first_byte(*container), sizeof(Offset_t)));
@@ -601,6 +617,139 @@ struct Diff_flat_arrays_base {
         if (refs().size()) {
             assert(refs().back().last_byte(*container) == container->size());
         }
+    }
+
+    /**
+     * Apply all queued diffs. The changes are collected and sorted by their position in the
+     * container, which is then rebuilt in a single pass, starting at the first change. Indices of
+     * REMOVE diffs refer to the arrays as they were before, removing the same element twice has no
+     * further effect. Arrays whose header lies inside of a removed element are unregistered (their
+     * contents remain in the container).
+     */
+    void apply() {
+        if (not first()) return;
+        check_refs();
+
+        int n_refs = refs().size();
+        batch_refs.reset();
+        for (auto const& r: refs()) {
+            batch_refs.emplace_back<Batch_ref>(Batch_ref {r.offset + r.ref(*container).start, 0});
+        }
+        Batch_ref* ref_info = (Batch_ref*)batch_refs.data();
+
+        batch_edits.reset();
+        u16 seq = 0;
+        for (int i = first(); i; next(&i), ++seq) {
+            u8 type = diffs[i];
+            u8 ref  = diffs[i+1];
+            if (type == REMOVE_IGNORE) continue;
+            
+            auto const& r = refs()[ref];
+            if (type == ADD) {
+                batch_edits.emplace_back<Batch_edit>(Batch_edit {
+                    r.last_byte(*container), i+2, 0, seq, ref, r.element_size
+                });
+            } else if (type == REMOVE) {
+                auto const& arr = r.ref(*container);
+                assert(diffs[i+2] < arr.size());
+                int pos = (char const*)arr.begin() - container->begin() + diffs[i+2] * r.element_size;
+                batch_edits.emplace_back<Batch_edit>(Batch_edit {
+                    pos, -1, 0, seq, ref, r.element_size
+                });
+            } else {
+                assert(false);
+            }
+        }
+
+        // Sort by position, with insertions in the order they were queued
+        Batch_edit* edits = (Batch_edit*)batch_edits.data();
+        int n_edits = batch_edits.size() / sizeof(Batch_edit);
+        std::sort(edits, edits + n_edits, [](Batch_edit const& a, Batch_edit const& b) {
+            return a.pos != b.pos ? a.pos < b.pos : a.seq < b.seq;
+        });
+
+        // Drop duplicate removals and compute the change in position after each edit
+        int n = 0;
+        int shift = 0;
+        for (int i = 0; i < n_edits; ++i) {
+            if (edits[i].src < 0 and n > 0 and edits[n-1].src < 0 and edits[n-1].pos == edits[i].pos) {
+                continue;
+            }
+            edits[n] = edits[i];
+            int delta = edits[n].src >= 0 ? edits[n].len : -edits[n].len;
+            shift += delta;
+            ref_info[edits[n].ref].delta += delta > 0 ? 1 : -1;
+            edits[n].shift = shift;
+            ++n;
+        }
+        n_edits = n;
+        if (n_edits == 0) {
+            diffs.resize(_first);
+            return;
+        }
+
+        // Rebuild everything from the first change on
+        int lo = edits[0].pos;
+        int old_size = container->size();
+        batch_tail.reset();
+        batch_tail.append(container->data() + lo, old_size - lo);
+        container->reserve_space(std::max(shift, 0));
+        
+        char* out = container->data() + lo;
+        int in = lo;
+        for (int i = 0; i < n_edits; ++i) {
+            std::memcpy(out, batch_tail.data() + (in - lo), edits[i].pos - in);
+            out += edits[i].pos - in;
+            in = edits[i].pos;
+            if (edits[i].src >= 0) {
+                std::memcpy(out, diffs.data() + edits[i].src, edits[i].len);
+                out += edits[i].len;
+            } else {
+                in += edits[i].len;
+            }
+        }
+        std::memcpy(out, batch_tail.data() + (in - lo), old_size - in);
+        container->addsize(shift);
+
+        // Map a position from before to after the edits. Returns -1 for removed positions.
+        auto map_pos = [edits, n_edits](int pos) {
+            auto it = std::upper_bound(edits, edits + n_edits, pos, [](int pos, Batch_edit const& e) {
+                return pos < e.pos;
+            });
+            if (it == edits) return pos;
+            --it;
+            if (it->src < 0 and pos < it->pos + it->len) return -1;
+            return pos + it->shift;
+        };
+
+        // Fix the registered arrays. The sizes of unregistered arrays are still updated, their
+        // contents should not depend on whether the header was removed before or after.
+        int j_out = 0;
+        for (int j = 0; j < n_refs; ++j) {
+            Flat_array_ref r = refs()[j];
+            int data = map_pos(ref_info[j].data);
+            assert(data != -1);
+            container->get<Size_t>(data) += ref_info[j].delta;
+            
+            int header = map_pos(r.first_byte(*container));
+            if (header == -1) continue;
+            narrow(container->get<Flat_array<char, Offset_t, Size_t>>(header).start, data - header);
+            narrow(r.offset, header);
+            refs()[j_out++] = r;
+        }
+        refs().m_size() = j_out;
+
+        diffs.resize(_first);
+    }
+
+    /**
+     * Apply the diffs one after another. This is the straightforward implementation, apply is
+     * tested against it.
+     */
+    void apply_each() {
+        if (not first()) return;
+        check_refs();
+        
         for (int i = first(); i; next(&i)) {
             u8 type = diffs[i];
             u8 ref  = diffs[i+1];
@@ -729,6 +878,21 @@ struct Flat_idmap_base {
 		return id;
 	}
 
+	/**
+	 * Return the id associated with the object obj, or 0 if it does not exist.
+	 * (Usually the empty object has the id 0.) Unlike the other get_id, this
+	 * does not modify the map.
+	 */
+	Id_t find_id(Buffer_view obj) const {
+		Id_t orig_id = obj.get_hash() % Size;
+		Id_t id = orig_id;
+		while (map[id] and obj != get_value(id)) {
+			id = (id + 1) % Size;
+			if (id == orig_id) return 0;
+		}
+		return map[id] ? id : 0;
+	}
+
 	/**
 	 * Return the id associated with the object obj. If it does not already
 	 * exists, it is inserted. The Buffer must contain the Flat_idmap object.
@@ -18,6 +18,7 @@
 // lampe general headers
 #include <algorithm>
 #include <cmath>
+#include <condition_variable>
 #include <csignal>
 #include <cstdint>
 #include <cstdlib>
@@ -45,11 +46,13 @@
 // pugixml headers
 #include "pugixml.hpp"
 
-// win32 libraries
+// win32 libraries. The POSIX sources include what they need themselves.
+#ifdef _WIN32
 #include <io.h>
 #include <winsock2.h>
 #include <windows.h>
 #include <ws2tcpip.h>
+#endif
 
 #ifdef NDEBUG
 
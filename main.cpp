@@ -8,6 +8,7 @@
 #include "statistics.hpp"
 #include "test.hpp"
 #include "utilities.hpp"
+#include "replay.hpp"
 
 #include "debug.hpp"
 
@@ -25,7 +26,7 @@ void print_usage(c_str argv0) {
 		<< " " << HOST_IP << " [ip]    The IP address for connecting with an external server.\n"
 		<< " " << HOST_PORT << " [port]  The port for connecting with an external server.\n"
 		<< " " << DUMP_XML << " [path]  Debug option. If this is specified all xml messages betwe"
-		<< "en the server and the program are dumped into a file.\n\n"
+		<< "en the server and the program are dumped into a file. In mode parse, the file is read.\n\n"
         << " " << MASSIM_QUIET << "  The output of the internal MASSim is not printed to the "
         << "console.\n"
 		<< " " << ADD_AGENT << " [name] [password]  The login credentials for an agent. This opti"
@@ -35,7 +36,22 @@ void print_usage(c_str argv0) {
 		<< " " << ADD_DUMMY << " [name] [password]  Like " << ADD_AGENT << " but adds a dummy tha"
 		<< "t does not do anything.\n"
 		<< " " << LOAD_CFGFILE << " [path]  The file is interpreted as a configfile. See below for"
-		<< " the syntax.\n\n"
+		<< " the syntax.\n"
+		<< " " << CAPTURE_FILE << " [path]  In mode play, the situation of each step is written int"
+		<< "o the file. In mode replay, the file is read.\n"
+		<< " " << REPLAY_ITERATIONS << " [n]  The number of search iterations per step in mode repl"
+		<< "ay (default 200).\n"
+		<< " " << SEARCH_MODE << " [mode]  The search used for the strategies, either " << SEARCH_MODE_FLAT
+		<< " (the default), which chooses among all of them, or " << SEARCH_MODE_TREE << ", which descen"
+		<< "ds the tree of strategies using progressive widening.\n"
+		<< " " << PARSE_THREADS << " [n]  Parse the percepts of the agents on n worker threads, as "
+		<< "they arrive. The default 0 parses them on the main thread.\n"
+		<< " " << SOCKET_BUFFER << " [bytes]  The size of the receive and send buffers of the sock"
+		<< "ets (SO_RCVBUF and SO_SNDBUF). The default 0 keeps the size chosen by the system.\n"
+		<< " " << RECORD_FILE << " [path]  All messages sent and received are recorded into the fi"
+		<< "le, with their times. In mode serve, the file is played back.\n"
+		<< " " << REPLAY_SPEED << " [factor]  How much faster than recorded mode serve sends the me"
+		<< "ssages (default 1). With 0, they are sent as soon as the agents answered.\n\n"
 		<< " The programm determines automatically whether to run the internal server or connect t"
 		<< "o an external server by checking with options have been specified (" << MASSIM_LOC
 		<< " and " << CONFIG_LOC << " respectively, the latter has higher priority).\n\n"
@@ -44,7 +60,12 @@ void print_usage(c_str argv0) {
 		<< "s it to be ignored, or has the following form:\n   option arg1 [arg2]\n\n "
         << LAMPE_SHIP << " [ship]  Specifies the type of operation. Must be one of:\n    test  To "
         << "run a quick self-check\n    stats  To collect statistical information about simulation"
-        << "s and append them to the specified file\n\n";
+        << "s and append them to the specified file\n    play  To play a match\n    replay  To rer"
+        << "un the search on a captured match, without a server, and print timings\n    parse  To "
+        << "compare the parsers on the messages of an xml dump\n    sockets  To measure the ro"
+        << "und-trip time of a loopback connection and the time to send the actions of a team\n  "
+        << "  serve  To play a recording back as a server on localhost, instead of MASSim. Connect"
+        << " to it with " << HOST_IP << " localhost in a second instance\n\n";
 }
 
 /**
@@ -97,6 +118,70 @@ bool parse_cmdline(int argc, c_str const* argv, Server_options* into, bool no_re
             if (not pop(&into->statistics_file)) {
                 return false;
             }
+        } else if (arg == CAPTURE_FILE) {
+            if (not pop(&into->capture_file)) {
+                return false;
+            }
+        } else if (arg == RECORD_FILE) {
+            if (not pop(&into->record_file)) {
+                return false;
+            }
+        } else if (arg == REPLAY_SPEED) {
+            Buffer_view tmp;
+            if (not pop(&tmp)) {
+                return false;
+            }
+            into->replay_speed = std::atof(tmp.c_str());
+            if (into->replay_speed < 0.0) {
+                jerr << "Error: the speed must not be negative\n";
+                return false;
+            }
+        } else if (arg == REPLAY_ITERATIONS) {
+            Buffer_view tmp;
+            if (not pop(&tmp)) {
+                return false;
+            }
+            into->replay_iterations = std::atoi(tmp.c_str());
+            if (into->replay_iterations <= 0) {
+                jerr << "Error: the number of iterations must be positive\n";
+                return false;
+            }
+        } else if (arg == SEARCH_MODE) {
+            Buffer_view tmp;
+            if (not pop(&tmp)) {
+                return false;
+            }
+            if (tmp == SEARCH_MODE_FLAT) {
+                into->search_mode = Server_options::SEARCH_FLAT;
+            } else if (tmp == SEARCH_MODE_TREE) {
+                into->search_mode = Server_options::SEARCH_TREE;
+            } else {
+                jerr << "Error: unknown search mode '" << tmp << "', must be one of " << SEARCH_MODE_FLAT
+                     << " or " << SEARCH_MODE_TREE << '\n';
+                return false;
+            }
+        } else if (arg == PARSE_THREADS) {
+            Buffer_view tmp;
+            if (not pop(&tmp)) {
+                return false;
+            }
+            into->parse_threads = std::atoi(tmp.c_str());
+            if (into->parse_threads < 0) {
+                jerr << "Error: the number of parse threads must not be negative\n";
+                return false;
+            }
+        } else if (arg == SOCKET_BUFFER) {
+            Buffer_view tmp;
+            if (not pop(&tmp)) {
+                return false;
+            }
+            int size = std::atoi(tmp.c_str());
+            if (size < 0) {
+                jerr << "Error: the socket buffer size must not be negative\n";
+                return false;
+            }
+            into->socket_options.recv_buffer_size = size;
+            into->socket_options.send_buffer_size = size;
         } else if(arg == LAMPE_SHIP) {
             Buffer_view tmp;
             if (not pop(&tmp)) {
@@ -112,9 +197,19 @@ bool parse_cmdline(int argc, c_str const* argv, Server_options* into, bool no_re
 				into->ship = Server_options::SHIP_STATS;
 			} else if (tmp == LAMPE_SHIP_PLAY) {
 				into->ship = Server_options::SHIP_PLAY;
+			} else if (tmp == LAMPE_SHIP_REPLAY) {
+				into->ship = Server_options::SHIP_REPLAY;
+			} else if (tmp == LAMPE_SHIP_PARSE) {
+				into->ship = Server_options::SHIP_PARSE;
+			} else if (tmp == LAMPE_SHIP_SOCKETS) {
+				into->ship = Server_options::SHIP_SOCKETS;
+			} else if (tmp == LAMPE_SHIP_SERVE) {
+				into->ship = Server_options::SHIP_SERVE;
 			} else {
 				jerr << "Error: unknown ship '" << tmp << "', must be one of " << LAMPE_SHIP_TEST
-                     << ", " << LAMPE_SHIP_STATS << " or " << LAMPE_SHIP_PLAY << '\n';
+                     << ", " << LAMPE_SHIP_STATS << ", " << LAMPE_SHIP_PLAY << ", "
+                     << LAMPE_SHIP_REPLAY << ", " << LAMPE_SHIP_PARSE << ", " << LAMPE_SHIP_SOCKETS
+                     << " or " << LAMPE_SHIP_SERVE << '\n';
 				return false;
             }
         } else if (arg == ADD_AGENT or arg == ADD_DUMMY) {
@@ -267,6 +362,9 @@ int main(int argc, c_str const* argv) {
 	}
 
     Socket_context socket_context;
+    if (options.record_file and options.ship != Server_options::SHIP_SERVE) {
+        record_traffic(options.record_file);
+    }
     
 	if (options.ship == Server_options::SHIP_TEST) {
 		while (true) try {
@@ -327,6 +425,10 @@ int main(int argc, c_str const* argv) {
 		auto server_wrapper = std::make_unique<Server>(options);
 		server = server_wrapper.get();
 		Mothership_complex mothership;
+        mothership.search_mode = options.search_mode;
+        if (options.capture_file) {
+            mothership.capture.open(options.capture_file);
+        }
 		if (options.dump_xml) {
 			dump_xml = std::ofstream{ options.dump_xml.c_str() };
 			init_messages(&dump_xml);
@@ -341,6 +443,40 @@ int main(int argc, c_str const* argv) {
         
 		server->register_mothership(&mothership);
 		server->run_simulation();
+	} else if (options.ship == Server_options::SHIP_REPLAY) {
+        auto server_wrapper = std::make_unique<Server>(options);
+        server = server_wrapper.get();
+        init_messages();
+
+        if (not server->load_maps()) {
+            return 2;
+        }
+
+        if (int code = replay_main(server, options)) {
+            return code;
+        }
+	} else if (options.ship == Server_options::SHIP_PARSE) {
+        auto server_wrapper = std::make_unique<Server>(options);
+        server = server_wrapper.get();
+        init_messages();
+
+        if (not server->load_maps()) {
+            return 2;
+        }
+
+        if (int code = parse_bench_main(server, options)) {
+            return code;
+        }
+	} else if (options.ship == Server_options::SHIP_SOCKETS) {
+        init_messages();
+        if (int code = socket_bench_main(options)) {
+            return code;
+        }
+	} else if (options.ship == Server_options::SHIP_SERVE) {
+        init_messages();
+        if (int code = serve_main(options)) {
+            return code;
+        }
 	} else {
         while (true) {
             try {
@@ -2,6 +2,7 @@
 #include "messages.hpp"
 
 #include "debug.hpp"
+#include "system.hpp"
 
 namespace jup {
 
@@ -35,14 +36,12 @@ struct Buffer_writer: public pugi::xml_writer {
 	Buffer* buf;
 };
 
-// This buffer contains all the memory that is needed for the messages. It
-// should not relocate during operations! (This is not optimal. However, the
+// This buffer contains the memory pugi needs for the messages, the text itself
+// stays in the receive buffer of the socket. It should not relocate during
+// operations! (This is not optimal. However, the
 // maximum amount needed for parsing a message should stay constant.)
 static Buffer memory_for_messages;
 
-// The additional data behind a message (that belongs to the next message in the socket)
-static Buffer additional_data;
-
 static int idmap_offset;
 static int idmap16_offset;
 
@@ -59,8 +58,41 @@ static Buffer memory_for_strings;
 // If this is not null, each message will be dumped in xml form into the stream.
 static std::ostream* dump_xml_output;
 
+// If this is open, each message is recorded into it, see record_traffic.
+static std::ofstream traffic_output;
+static double traffic_time_begin;
+
 // The graph representing the map we currently are on.
 static Graph* current_map_graph;
+
+// The parser used for incoming messages, see set_messages_parser. Its arrays are reused.
+static u8 messages_parser = PARSER_STREAM;
+static Xml_parser xml_parser;
+
+// On the workers of Parse_pool, get_id and get_id16 only look strings up, as registering them
+// would modify memory_for_strings. ids_missing is set if a string was not found, and the string is
+// appended to ids_missing_strings, see Parse_pool::Job::missing_ids.
+static thread_local bool ids_lookup_only = false;
+static thread_local bool ids_missing = false;
+static thread_local Buffer* ids_missing_strings = nullptr;
+
+// The shared sections of the percepts parsed in the current step, see Shared_section_stats. These
+// are used by the workers of Parse_pool as well, so they are guarded by shared_mutex.
+struct Shared_section {
+	u64 hash;
+	// What was hashed, compared before the section is reused, see hash_shared_sections
+	Buffer key;
+	int step;
+	// Where the arrays of the percept begin, relative to the beginning of data
+	int starts[11];
+	Buffer data;
+};
+constexpr static int shared_sections_max = 4;
+static std::mutex shared_mutex;
+static Shared_section shared_sections[shared_sections_max];
+static int shared_section_count = 0;
+static int shared_section_step = -1;
+static Shared_section_stats shared_stats;
     
 /**
  * Implement the pugi memory function. This tries to get the memory from
@@ -121,9 +153,66 @@ void init_messages(std::ostream* _dump_xml_output) {
     current_map_graph = nullptr;
 }
 
+// see header
+void record_traffic(Buffer_view path) {
+	if (traffic_output.is_open()) {
+		traffic_output.close();
+	}
+	traffic_output.open(path.c_str(), std::ios::out | std::ios::binary);
+	if (not traffic_output) {
+		jerr << "Warning: Could not open the recording file " << path.c_str()
+			 << ", nothing will be recorded.\n";
+	}
+	traffic_time_begin = elapsed_time();
+}
+
+// see header
+void flush_traffic_recording() {
+	if (traffic_output.is_open()) {
+		traffic_output.flush();
+	}
+}
+
+static void write_traffic_record(u8 direction, Socket const& sock, Buffer_view text) {
+	Traffic_record record;
+	record.direction = direction;
+	narrow(record.socket, sock.get_id());
+	record.size = text.size();
+	record.time = (u64)((elapsed_time() - traffic_time_begin) * 1e6);
+	traffic_output.write((char const*)&record, sizeof(record));
+	traffic_output.write(text.data(), text.size());
+}
+
 // see header
 void set_messages_graph(Graph* graph) {
     current_map_graph = graph;
+
+    // The positions depend on the graph
+    std::lock_guard<std::mutex> lock {shared_mutex};
+    shared_section_count = 0;
+    shared_section_step = -1;
+}
+
+// see header
+void set_messages_parser(u8 parser) {
+    assert(parser == PARSER_STREAM or parser == PARSER_PUGI);
+    messages_parser = parser;
+}
+
+// see header
+Shared_section_stats get_shared_section_stats(bool reset) {
+    std::lock_guard<std::mutex> lock {shared_mutex};
+    Shared_section_stats result = shared_stats;
+    if (reset) shared_stats = Shared_section_stats {};
+    return result;
+}
+
+static void add_missing_id(u8 id_size, Buffer_view str) {
+	ids_missing = true;
+	if (not ids_missing_strings) return;
+	ids_missing_strings->append(&id_size, 1);
+	ids_missing_strings->append(str);
+	ids_missing_strings->append0();
 }
 
 /**
@@ -131,9 +220,19 @@ void set_messages_graph(Graph* graph) {
  * generated.
  */
 u8  get_id(Buffer_view str) {
+	if (ids_lookup_only) {
+		u8 id = idmap().find_id(str);
+		if (id == 0 and str.size()) add_missing_id(sizeof(u8), str);
+		return id;
+	}
 	return idmap()  .get_id(str, &memory_for_strings);
 }
 u16 get_id16(Buffer_view str) {
+	if (ids_lookup_only) {
+		u16 id = idmap16().find_id(str);
+		if (id == 0 and str.size()) add_missing_id(sizeof(u16), str);
+		return id;
+	}
 	return idmap16().get_id(str, &memory_for_strings);
 }
 u8  register_id  (Buffer_view str) { return get_id  (str); }
@@ -147,6 +246,21 @@ u16 get_id_from_string16(Buffer_view str) { return idmap16().get_id(str); }
 Buffer_view get_string_from_id(u8  id) { return idmap()  .get_value(id); }
 Buffer_view get_string_from_id(u16 id) { return idmap16().get_value(id); }
 
+// see header
+void save_string_ids(Buffer* into) {
+    assert(into);
+    into->emplace_back<int>(idmap_offset);
+    into->emplace_back<int>(idmap16_offset);
+    into->append(memory_for_strings);
+}
+void load_string_ids(Buffer_view data) {
+    assert(data.size() >= 2 * (int)sizeof(int));
+    std::memcpy(&idmap_offset,   data.data(),               sizeof(int));
+    std::memcpy(&idmap16_offset, data.data() + sizeof(int), sizeof(int));
+    memory_for_strings.reset();
+    memory_for_strings.append(data.data() + 2 * sizeof(int), data.size() - 2 * sizeof(int));
+}
+
 /**
  * Construct the Pos object from the coordinates in xml_obj
  */
@@ -293,6 +407,7 @@ void parse_request_action(pugi::xml_node xml_perc, Buffer* into) {
 	auto& perc = into->emplace_back<Message_Request_Action>().perception;
 
 	narrow(perc.deadline, xml_perc.attribute("deadline").as_ullong());
+	narrow(perc.timestamp, xml_perc.parent().attribute("timestamp").as_ullong());
 	narrow(perc.id,       xml_perc.attribute("id")      .as_int());
 	narrow(perc.simulation_step,
 		   xml_perc.child("simulation").attribute("step").as_int());
@@ -549,82 +664,658 @@ void parse_request_action(pugi::xml_node xml_perc, Buffer* into) {
 	assert(into->size() - prev_size == space_needed);
 }
 
+// The streaming variants of the functions above. They produce exactly the same output, but read
+// from an Xml_parser instead of a pugi document.
+
+#define xml_children(var, parent, name) \
+	for (int var = xml.child(parent, name); var != -1; var = xml.next(var, name))
+
+static Pos get_pos(Xml_parser const& xml, int xml_obj) {
+	double lat = xml.attr_double(xml_obj, XML_LAT);
+	double lon = xml.attr_double(xml_obj, XML_LON);
+	return current_map_graph->get_pos(lat, lon);
+}
+
 /**
- * This is a helper struct, managing the additional memory for the messages.
+ * Read the amount of an item, as it is clamped to the range of u8 in all the items we store.
  */
-struct Additional_block {
-    int id;
-    int size;
-    char* data() { return (char*)(this + 1); }
-    int offset() { return sizeof(Additional_block) + size; }
-};
+static u8 get_amount(Xml_parser const& xml, int xml_item, u8 name = XML_AMOUNT) {
+	int amount = xml.attr_int(xml_item, name);
+	if (amount > 254) return 254;
+	u8 result;
+	narrow(result, amount);
+	return result;
+}
+
+void parse_auth_response(Xml_parser const& xml, int xml_obj, Buffer* into) {
+	assert(into);
+	auto& mess = into->emplace_back<Message_Auth_Response>();
+	auto succeeded = xml.attr(xml_obj, XML_RESULT);
+	if (std::strcmp(succeeded, "ok") == 0) {
+		mess.succeeded = true;
+	} else if (std::strcmp(succeeded, "fail") == 0) {
+		mess.succeeded = false;
+	} else {
+		assert(false);
+	}
+}
+
+void parse_sim_start(Xml_parser const& xml, int xml_obj, Buffer* into) {
+	assert(into);
+
+	int xml_role = xml.child(xml_obj, XML_ROLE);
+	int prev_size = into->size();
+	int space_needed = sizeof(Message_Sim_Start);
+	{
+		constexpr int s = sizeof(u8);
+		space_needed += s + sizeof(u8) * xml.count(xml_role, XML_TOOL);
+		space_needed += s;
+		xml_children(xml_item, xml_obj, XML_ITEM) {
+			space_needed += s * 2 + sizeof(Item)
+				+ sizeof(Item_stack) * xml.count(xml_item, XML_ITEM)
+				+ sizeof(u8) * xml.count(xml_item, XML_TOOL);
+		}
+	}
+	into->reserve_space(space_needed);
+	into->trap_alloc(true);
+
+	auto& sim = into->emplace_back<Message_Sim_Start>().simulation;
+	sim.id = get_id(xml.attr(xml_obj, XML_ID));
+	sim.map = get_id(xml.attr(xml_obj, XML_MAP));
+	narrow(sim.seed_capital, xml.attr_int(xml_obj, XML_SEED_CAPITAL));
+	narrow(sim.steps,        xml.attr_int(xml_obj, XML_STEPS));
+	sim.team = get_id(xml.attr(xml_obj, XML_TEAM));
+
+	sim.role.name = get_id(xml.attr(xml_role, XML_NAME));
+	narrow(sim.role.speed,   xml.attr_int(xml_role, XML_SPEED));
+	narrow(sim.role.battery, xml.attr_int(xml_role, XML_BATTERY));
+	narrow(sim.role.load,    xml.attr_int(xml_role, XML_LOAD));
+	sim.role.tools.init(into);
+	xml_children(xml_tool, xml_role, XML_TOOL) {
+		sim.role.tools.push_back(get_id(xml.attr(xml_tool, XML_NAME)), into);
+	}
+
+	sim.items.init(into);
+	xml_children(xml_item, xml_obj, XML_ITEM) {
+		Item item;
+		item.name = get_id(xml.attr(xml_item, XML_NAME));
+		narrow(item.volume, xml.attr_int(xml_item, XML_VOLUME));
+		sim.items.push_back(item, into);
+	}
+	Item* item = sim.items.begin();
+	xml_children(xml_item, xml_obj, XML_ITEM) {
+		assert(item != sim.items.end());
+		item->consumed.init(into);
+		xml_children(xml_consumed, xml_item, XML_ITEM) {
+			Item_stack stack;
+			stack.item = get_id(xml.attr(xml_consumed, XML_NAME));
+			narrow(stack.amount, xml.attr_int(xml_consumed, XML_AMOUNT));
+			item->consumed.push_back(stack, into);
+		}
+		item->tools.init(into);
+		xml_children(xml_tool, xml_item, XML_TOOL) {
+			item->tools.push_back(get_id(xml.attr(xml_tool, XML_NAME)), into);
+		}
+		++item;
+	}
+	assert(item == sim.items.end());
+
+	into->trap_alloc(false);
+	assert(into->size() - prev_size == space_needed);
+}
+
+void parse_sim_end(Xml_parser const& xml, int xml_obj, Buffer* into) {
+	assert(into);
+	auto& mess = into->emplace_back<Message_Sim_End>();
+	narrow(mess.ranking, xml.attr_int(xml_obj, XML_RANKING));
+	narrow(mess.score,   xml.attr_int(xml_obj, XML_SCORE));
+}
+
+/**
+ * Append the required items of all jobs of one kind. The jobs must have been pushed already.
+ */
+template <typename Job_t>
+static void parse_required(Xml_parser const& xml, int xml_perc, u8 name,
+		Flat_array<Job_t>& jobs, Buffer* into) {
+	Job_t* job = jobs.begin();
+	xml_children(xml_job, xml_perc, name) {
+		assert(job != jobs.end());
+		job->required.init(into);
+		xml_children(xml_item, xml_job, XML_REQUIRED) {
+			Item_stack item;
+			item.item = get_id(xml.attr(xml_item, XML_NAME));
+			item.amount = get_amount(xml, xml_item);
+			job->required.push_back(item, into);
+		}
+		++job;
+	}
+	assert(job == jobs.end());
+}
+
+/**
+ * Return the start offsets of the arrays of the percept that hold the shared sections, in the order
+ * they are written.
+ */
+static u16* shared_array_start(Percept& perc, int index) {
+	u16* starts[] = {
+		&perc.entities.start, &perc.charging_stations.start, &perc.dumps.start, &perc.shops.start,
+		&perc.storages.start, &perc.workshops.start, &perc.resource_nodes.start,
+		&perc.auctions.start, &perc.jobs.start, &perc.missions.start, &perc.posteds.start
+	};
+	static_assert(sizeof(starts) / sizeof(starts[0]) == sizeof(Shared_section::starts) / sizeof(int),
+		"The number of shared arrays is wrong");
+	assert(0 <= index and index < (int)(sizeof(starts) / sizeof(starts[0])));
+	return starts[index];
+}
+
+/**
+ * Write the elements of the percept that are the same for all agents, that is everything except
+ * simulation, self and team, into key and return its hash. This includes the structure of the
+ * elements and all attributes. Percepts with the same key have the same shared sections.
+ */
+static u64 hash_shared_sections(Xml_parser const& xml, int xml_perc, Buffer* key) {
+	assert(key);
+	key->reset();
+	auto add = [key](u8 c) { key->append(&c, 1); };
+	auto add_int = [key](int x) { key->append(&x, sizeof(x)); };
+
+	int perc_end = xml.node(xml_perc).next_sibling;
+	if (perc_end == -1) perc_end = xml.nodes.size();
+	for (int i = xml.node(xml_perc).first_child; i != -1; i = xml.node(i).next_sibling) {
+		u8 name = xml.node(i).name;
+		if (name == XML_SIMULATION or name == XML_SELF or name == XML_TEAM) continue;
+
+		// The descendants of an element directly follow it
+		int end = xml.node(i).next_sibling != -1 ? xml.node(i).next_sibling : perc_end;
+		for (int j = i; j < end; ++j) {
+			auto const& node = xml.node(j);
+			add(node.name);
+			add(node.attr_count);
+			add_int(node.first_child  == -1 ? -1 : node.first_child  - j);
+			add_int(node.next_sibling == -1 ? -1 : node.next_sibling - j);
+			for (int k = node.attr_first; k < node.attr_first + node.attr_count; ++k) {
+				auto const& attr = xml.attrs.data()[k];
+				add(attr.name);
+				key->append(attr.value, std::strlen(attr.value) + 1);
+			}
+		}
+	}
+
+	// Like FNV-1a, but eight bytes at a time. The key is compared anyways, so this only has to
+	// tell different keys apart quickly.
+	u64 hash = 14695981039346656037ull;
+	int size = key->size();
+	key->append0((8 - size % 8) % 8);
+	for (int i = 0; i < key->size(); i += 8) {
+		u64 word;
+		std::memcpy(&word, key->data() + i, 8);
+		hash = (hash ^ word) * 1099511628211ull;
+	}
+	key->resize(size);
+	return hash;
+}
+
+/**
+ * If shared sections with this hash and key have been parsed in the step of perc, append them to
+ * into and point the arrays of perc to them. Returns whether that happened.
+ */
+static bool reuse_shared_sections(u64 hash, Buffer const& key, Percept* perc, Buffer* into,
+		double hash_time) {
+	assert(perc and into);
+	double time_begin = elapsed_time();
+	std::lock_guard<std::mutex> lock {shared_mutex};
+	shared_stats.overhead_time += hash_time;
+	if (perc->simulation_step != shared_section_step) return false;
+
+	for (int i = 0; i < shared_section_count; ++i) {
+		Shared_section const& section = shared_sections[i];
+		if (section.hash != hash or section.key.size() != key.size()
+			or std::memcmp(section.key.data(), key.data(), key.size())) continue;
+
+		char* begin = into->end();
+		into->append(section.data);
+		for (int j = 0; j < (int)(sizeof(section.starts) / sizeof(int)); ++j) {
+			u16* start = shared_array_start(*perc, j);
+			narrow(*start, begin + section.starts[j] - (char*)start);
+		}
+
+		++shared_stats.reused;
+		shared_stats.bytes_reused += section.data.size();
+		shared_stats.overhead_time += elapsed_time() - time_begin;
+		return true;
+	}
+	return false;
+}
+
+/**
+ * Remember the shared sections of perc, which were written to into starting at begin.
+ */
+static void add_shared_sections(u64 hash, Buffer const& key, Percept& perc, Buffer const& into,
+		int begin, double parse_time) {
+	std::lock_guard<std::mutex> lock {shared_mutex};
+	++shared_stats.parsed;
+	shared_stats.parse_time += parse_time;
+
+	// Messages with missing ids are written again, see Parse_pool::finish
+	if (ids_missing) return;
+
+	if (perc.simulation_step > shared_section_step) {
+		shared_section_count = 0;
+		shared_section_step = perc.simulation_step;
+	} else if (perc.simulation_step < shared_section_step) {
+		return;
+	}
+	if (shared_section_count == shared_sections_max) return;
+
+	Shared_section& section = shared_sections[shared_section_count++];
+	section.hash = hash;
+	section.key.reset();
+	section.key.append(key);
+	section.step = perc.simulation_step;
+	section.data.reset();
+	section.data.append(into.data() + begin, into.size() - begin);
+	for (int j = 0; j < (int)(sizeof(section.starts) / sizeof(int)); ++j) {
+		u16* start = shared_array_start(perc, j);
+		section.starts[j] = (char const*)start + *start - (into.data() + begin);
+	}
+}
+
+void parse_request_action(Xml_parser const& xml, int xml_mess, Buffer* into) {
+	assert(into);
+	int xml_perc = xml.child(xml_mess, XML_PERCEPT);
+	int xml_self = xml.child(xml_perc, XML_SELF);
+
+	// The node table is complete at this point, so the sizes are known before anything is written.
+	int prev_size = into->size();
+	int space_needed = sizeof(Message_Request_Action);
+	{
+		constexpr int s = sizeof(u8);
+		space_needed += s + sizeof(Item_stack) * xml.count(xml_self, XML_ITEMS);
+		space_needed += s + sizeof(Pos)        * xml.count(xml_self, XML_ROUTE);
+		space_needed += 7 * s + 4 * s;
+
+		for (int i = xml.node(xml_perc).first_child; i != -1; i = xml.node(i).next_sibling) {
+			switch (xml.node(i).name) {
+			case XML_ENTITY:           space_needed += sizeof(Entity);           break;
+			case XML_CHARGING_STATION: space_needed += sizeof(Charging_station); break;
+			case XML_DUMP:             space_needed += sizeof(Dump);             break;
+			case XML_WORKSHOP:         space_needed += sizeof(Workshop);         break;
+			case XML_RESOURCE_NODE:    space_needed += sizeof(Resource_node);    break;
+			case XML_SHOP:
+				space_needed += sizeof(Shop) + s + sizeof(Shop_item) * xml.count(i, XML_ITEM);
+				break;
+			case XML_STORAGE:
+				space_needed += sizeof(Storage) + s
+					+ sizeof(Storage_item) * xml.count(i, XML_ITEM);
+				break;
+			case XML_AUCTION:
+				space_needed += sizeof(Auction) + s
+					+ sizeof(Item_stack) * xml.count(i, XML_REQUIRED);
+				break;
+			case XML_JOB:
+				space_needed += sizeof(Job) + s
+					+ sizeof(Item_stack) * xml.count(i, XML_REQUIRED);
+				break;
+			case XML_MISSION:
+				space_needed += sizeof(Mission) + s
+					+ sizeof(Item_stack) * xml.count(i, XML_REQUIRED);
+				break;
+			case XML_POSTED:
+				space_needed += sizeof(Posted) + s
+					+ sizeof(Item_stack) * xml.count(i, XML_REQUIRED);
+				break;
+			default: break;
+			}
+		}
+	}
+
+	into->reserve_space(space_needed);
+	into->trap_alloc(true);
+
+	auto& perc = into->emplace_back<Message_Request_Action>().perception;
+
+	narrow(perc.deadline,  xml.attr_ullong(xml_perc, XML_DEADLINE));
+	narrow(perc.timestamp, xml.attr_ullong(xml_mess, XML_TIMESTAMP));
+	narrow(perc.id,        xml.attr_int   (xml_perc, XML_ID));
+	narrow(perc.simulation_step,
+		   xml.attr_int(xml.child(xml_perc, XML_SIMULATION), XML_STEP));
+
+	auto& self = perc.self;
+	self.name = get_id(xml.attr(xml_self, XML_NAME));
+	self.team = get_id(xml.attr(xml_self, XML_TEAM));
+	self.pos = get_pos(xml, xml_self);
+	self.role = get_id(xml.attr(xml_self, XML_ROLE));
+	self.facility = get_id(xml.attr(xml_self, XML_FACILITY));
+	narrow(self.charge, xml.attr_int(xml_self, XML_CHARGE));
+	narrow(self.load,   xml.attr_int(xml_self, XML_LOAD));
+
+	int xml_action = xml.child(xml_self, XML_ACTION);
+	self.action_type = Action::get_id(xml.attr(xml_action, XML_TYPE));
+	self.action_result = Action::get_result_id(xml.attr(xml_action, XML_RESULT));
+
+	self.items.init(into);
+	xml_children(xml_item, xml_self, XML_ITEMS) {
+		Item_stack item;
+		item.item = get_id(xml.attr(xml_item, XML_NAME));
+		item.amount = get_amount(xml, xml_item);
+		self.items.push_back(item, into);
+	}
+	self.route.init(into);
+	xml_children(xml_node, xml_self, XML_ROUTE) {
+		self.route.push_back(get_pos(xml, xml_node), into);
+	}
+
+	narrow(perc.team_money, xml.attr_int(xml.child(xml_perc, XML_TEAM), XML_MONEY));
+
+	// The rest is the same for all agents, and only parsed once per step if possible
+	double time_begin = elapsed_time();
+	static thread_local Buffer shared_key;
+	u64 shared_hash = hash_shared_sections(xml, xml_perc, &shared_key);
+	int shared_begin = into->size();
+	if (reuse_shared_sections(shared_hash, shared_key, &perc, into, elapsed_time() - time_begin)) {
+		into->trap_alloc(false);
+		assert(into->size() - prev_size == space_needed);
+		return;
+	}
+	time_begin = elapsed_time();
+
+	perc.entities.init(into);
+	xml_children(xml_ent, xml_perc, XML_ENTITY) {
+		Entity ent;
+		ent.name = get_id(xml.attr(xml_ent, XML_NAME));
+		ent.team = get_id(xml.attr(xml_ent, XML_TEAM));
+		ent.pos = get_pos(xml, xml_ent);
+		ent.role = get_id(xml.attr(xml_ent, XML_ROLE));
+		perc.entities.push_back(ent, into);
+	}
+
+	perc.charging_stations.init(into);
+	xml_children(xml_fac, xml_perc, XML_CHARGING_STATION) {
+		Charging_station fac;
+		fac.name = get_id(xml.attr(xml_fac, XML_NAME));
+		fac.pos = get_pos(xml, xml_fac);
+		narrow(fac.rate, xml.attr_int(xml_fac, XML_RATE));
+		perc.charging_stations.push_back(fac, into);
+	}
+	perc.dumps.init(into);
+	xml_children(xml_fac, xml_perc, XML_DUMP) {
+		Dump fac;
+		fac.name = get_id(xml.attr(xml_fac, XML_NAME));
+		fac.pos = get_pos(xml, xml_fac);
+		perc.dumps.push_back(fac, into);
+	}
+
+	perc.shops.init(into);
+	xml_children(xml_fac, xml_perc, XML_SHOP) {
+		Shop fac;
+		fac.name = get_id(xml.attr(xml_fac, XML_NAME));
+		fac.pos = get_pos(xml, xml_fac);
+		narrow(fac.restock, xml.attr_int(xml_fac, XML_RESTOCK));
+		perc.shops.push_back(fac, into);
+	}
+	Shop* shop = perc.shops.begin();
+	xml_children(xml_fac, xml_perc, XML_SHOP) {
+		assert(shop != perc.shops.end());
+		shop->items.init(into);
+		xml_children(xml_item, xml_fac, XML_ITEM) {
+			Shop_item item;
+			item.item = get_id(xml.attr(xml_item, XML_NAME));
+			item.amount = get_amount(xml, xml_item);
+			if (xml.attr_int(xml_item, XML_PRICE) > 65535) {
+				item.cost = 65535;
+			} else {
+				narrow(item.cost, xml.attr_int(xml_item, XML_PRICE));
+			}
+			shop->items.push_back(item, into);
+		}
+		++shop;
+	}
+	assert(shop == perc.shops.end());
+
+	perc.storages.init(into);
+	xml_children(xml_fac, xml_perc, XML_STORAGE) {
+		Storage fac;
+		fac.name = get_id(xml.attr(xml_fac, XML_NAME));
+		fac.pos = get_pos(xml, xml_fac);
+		narrow(fac.total_capacity, xml.attr_int(xml_fac, XML_TOTAL_CAPACITY));
+		narrow(fac.used_capacity,  xml.attr_int(xml_fac, XML_USED_CAPACITY));
+		perc.storages.push_back(fac, into);
+	}
+	Storage* storage = perc.storages.begin();
+	xml_children(xml_fac, xml_perc, XML_STORAGE) {
+		assert(storage != perc.storages.end());
+		storage->items.init(into);
+		xml_children(xml_item, xml_fac, XML_ITEM) {
+			Storage_item item;
+			item.item = get_id(xml.attr(xml_item, XML_NAME));
+			narrow(item.amount,    xml.attr_int(xml_item, XML_STORED));
+			narrow(item.delivered, xml.attr_int(xml_item, XML_DELIVERED));
+			storage->items.push_back(item, into);
+		}
+		++storage;
+	}
+	assert(storage == perc.storages.end());
+
+	perc.workshops.init(into);
+	xml_children(xml_fac, xml_perc, XML_WORKSHOP) {
+		Workshop fac;
+		fac.name = get_id(xml.attr(xml_fac, XML_NAME));
+		fac.pos = get_pos(xml, xml_fac);
+		perc.workshops.push_back(fac, into);
+	}
+
+	perc.resource_nodes.init(into);
+	xml_children(xml_res, xml_perc, XML_RESOURCE_NODE) {
+		Resource_node res;
+		res.name = get_id(xml.attr(xml_res, XML_NAME));
+		res.pos = get_pos(xml, xml_res);
+		res.resource = get_id(xml.attr(xml_res, XML_RESOURCE));
+		perc.resource_nodes.push_back(res, into);
+	}
+
+	perc.auctions.init(into);
+	xml_children(xml_job, xml_perc, XML_AUCTION) {
+		Auction job;
+		job.id      = get_id16(xml.attr(xml_job, XML_ID));
+		job.storage = get_id  (xml.attr(xml_job, XML_STORAGE));
+		narrow(job.start,        xml.attr_int(xml_job, XML_START));
+		narrow(job.end,          xml.attr_int(xml_job, XML_END));
+		narrow(job.reward,       xml.attr_int(xml_job, XML_REWARD));
+		narrow(job.auction_time, xml.attr_int(xml_job, XML_AUCTION_TIME));
+		narrow(job.fine,         xml.attr_int(xml_job, XML_FINE));
+		perc.auctions.push_back(job, into);
+	}
+	parse_required(xml, xml_perc, XML_AUCTION, perc.auctions, into);
+
+	perc.jobs.init(into);
+	xml_children(xml_job, xml_perc, XML_JOB) {
+		Job job;
+		job.id      = get_id16(xml.attr(xml_job, XML_ID));
+		job.storage = get_id  (xml.attr(xml_job, XML_STORAGE));
+		narrow(job.start,  xml.attr_int(xml_job, XML_START));
+		narrow(job.end,    xml.attr_int(xml_job, XML_END));
+		narrow(job.reward, xml.attr_int(xml_job, XML_REWARD));
+		perc.jobs.push_back(job, into);
+	}
+	parse_required(xml, xml_perc, XML_JOB, perc.jobs, into);
+
+	perc.missions.init(into);
+	xml_children(xml_job, xml_perc, XML_MISSION) {
+		Mission job;
+		job.id      = get_id16(xml.attr(xml_job, XML_ID));
+		job.storage = get_id  (xml.attr(xml_job, XML_STORAGE));
+		narrow(job.start,        xml.attr_int(xml_job, XML_START));
+		narrow(job.end,          xml.attr_int(xml_job, XML_END));
+		narrow(job.reward,       xml.attr_int(xml_job, XML_REWARD));
+		narrow(job.auction_time, xml.attr_int(xml_job, XML_AUCTION_TIME));
+		narrow(job.fine,         xml.attr_int(xml_job, XML_FINE));
+		narrow(job.lowest_bid,   xml.attr_int(xml_job, XML_LOWEST_BID));
+		perc.missions.push_back(job, into);
+	}
+	parse_required(xml, xml_perc, XML_MISSION, perc.missions, into);
+
+	perc.posteds.init(into);
+	xml_children(xml_job, xml_perc, XML_POSTED) {
+		Posted job;
+		job.id      = get_id16(xml.attr(xml_job, XML_ID));
+		job.storage = get_id  (xml.attr(xml_job, XML_STORAGE));
+		narrow(job.start,  xml.attr_int(xml_job, XML_START));
+		narrow(job.end,    xml.attr_int(xml_job, XML_END));
+		narrow(job.reward, xml.attr_int(xml_job, XML_REWARD));
+		perc.posteds.push_back(job, into);
+	}
+	parse_required(xml, xml_perc, XML_POSTED, perc.posteds, into);
+
+	add_shared_sections(shared_hash, shared_key, perc, *into, shared_begin,
+		elapsed_time() - time_begin);
+
+	into->trap_alloc(false);
+	assert(into->size() - prev_size == space_needed);
+}
+
+#undef xml_children
+
+/**
+ * Drop the consumed messages from the receive buffer of the socket, moving the rest to the front.
+ */
+static void reclaim_received(Socket& sock) {
+    Buffer& data = sock.recv_buffer;
+    if (sock.recv_begin == 0) return;
+    int size = data.size() - sock.recv_begin;
+    std::memmove(data.data(), data.data() + sock.recv_begin, size);
+    data.resize(size);
+    sock.recv_begin = 0;
+}
+
+// see header
+void receive_available(Socket& sock) {
+    reclaim_received(sock);
+    sock.recv_available(&sock.recv_buffer);
+    assert(sock);
+}
+
+/**
+ * Consume the message of the socket that ends at zero and return its text.
+ */
+static void take_message(Socket& sock, char* zero, char** text, int* size) {
+    *text = sock.recv_buffer.data() + sock.recv_begin;
+    *size = zero + 1 - *text;
+    sock.recv_begin += *size;
+
+    if (traffic_output.is_open()) {
+        write_traffic_record(Traffic_record::INCOMING, sock, {*text, *size});
+    }
+    if (dump_xml_output) {
+        *dump_xml_output << "<<< incoming " << sock.get_id() << " <<<\n" << *text << '\n';
+    }
+}
+
+// see header
+bool take_message_text(Socket& sock, char** text, int* size) {
+    assert(text and size);
+    Buffer& data = sock.recv_buffer;
+    int rest = data.size() - sock.recv_begin;
+    char* zero = rest ? (char*)std::memchr(data.data() + sock.recv_begin, 0, rest) : nullptr;
+    if (not zero) return false;
+    take_message(sock, zero, text, size);
+    return true;
+}
+
+// see header
+bool message_buffered(Socket const& sock) {
+    Buffer const& data = sock.recv_buffer;
+    int size = data.size() - sock.recv_begin;
+    return size and std::memchr(data.data() + sock.recv_begin, 0, size);
+}
 
 // see header
 u8 get_next_message(Socket& sock, Buffer* into) {
 	assert(into);
+    Buffer& data = sock.recv_buffer;
 
-    memory_for_messages.reset();
-
-    // There may be data left from the last invocation, append it.
-    int id = sock.get_id();
-    for (int i = 0; i < additional_data.size();) {
-        auto& block = additional_data.get<Additional_block>(i);
-        if (block.id == id) {
-            memory_for_messages.append(block.data(), block.size);
-            int offset = block.offset();
-            char* next = ((char*)&block) + offset;
-            std::memmove((char*)&block, next, additional_data.end() - next);
-            additional_data.addsize(-offset);
-        } else {
-            i += block.offset();
-        }
+    // Drop the last message. Usually nothing else is left, as the server waits for our answer.
+    if (sock.recv_begin == data.size()) {
+        data.reset();
+        sock.recv_begin = 0;
     }
-    
+
+    memory_for_messages.reset();
 	// Make the buffer bigger if needed. This should not happen, but I don't
 	// like having no fallbacks.
 	if (additional_buffer_needed) {
 		memory_for_messages.reserve_space(additional_buffer_needed);
 		additional_buffer_needed = 0;
 	}
-    memory_for_messages.trap_alloc(true);
 
-    int prev_size = 0;
-	while (true) {
-        // The message is complete if there is a terminating zero, but there may
-        // be data behind that. This data will be collected in additional_data.
-        bool zero_found = false;
-        for (int i = prev_size; i < memory_for_messages.size(); ++i) {
-            if (memory_for_messages[i] == 0) {
-                int size = memory_for_messages.size() - i - 1;
-                if (size) {
-                    additional_data.emplace_back<Additional_block>(id, size);
-                    additional_data.append({memory_for_messages.data() + i+1, size});
-                    memory_for_messages.resize(i + 1);
-                }
-                zero_found = true;
-                break;
-            }
-        }
-        if (zero_found) break;
-        
-        prev_size = memory_for_messages.size();
-		sock.recv(&memory_for_messages);
+    // The message is complete if there is a terminating zero. Each byte is only searched once.
+    int searched = sock.recv_begin;
+    char* zero = nullptr;
+	while (searched == data.size()
+            or not (zero = (char*)std::memchr(data.data() + searched, 0, data.size() - searched))) {
+        // Move the start of the message to the front, instead of growing the buffer
+        reclaim_received(sock);
+        searched = data.size();
+		sock.recv(&data);
         assert(sock);
-		assert(memory_for_messages.size() > prev_size);
+		assert(data.size() > searched);
 	}
 
-    if (dump_xml_output) {
-        *dump_xml_output << "<<< incoming " << sock.get_id() << " <<<\n" << memory_for_messages.data() << '\n';
+    char* text;
+    int size;
+    take_message(sock, zero, &text, &size);
+    return parse_message(text, size, into);
+}
+
+/**
+ * Write the message that was read by parser into the Buffer. Returns its type.
+ */
+static u8 emit_message(Xml_parser const& parser, Buffer* into) {
+    int prev_size = into->size();
+    assert(parser.node(0).name == XML_MESSAGE);
+    auto type = parser.attr(0, XML_TYPE);
+
+    if (std::strcmp(type, "auth-response") == 0) {
+        parse_auth_response(parser, parser.child(0, XML_AUTH_RESPONSE), into);
+    } else if (std::strcmp(type, "sim-start") == 0) {
+        parse_sim_start(parser, parser.child(0, XML_SIMULATION), into);
+    } else if (std::strcmp(type, "sim-end") == 0) {
+        parse_sim_end(parser, parser.child(0, XML_SIM_RESULT), into);
+    } else if (std::strcmp(type, "request-action") == 0) {
+        parse_request_action(parser, 0, into);
+    } else if (std::strcmp(type, "bye") == 0) {
+        into->emplace_back<Message_Bye>();
+    } else {
+        assert(false);
+    }
+
+    auto& mess = into->get<Message_Server2Client>(prev_size);
+    narrow(mess.timestamp, parser.attr_ullong(0, XML_TIMESTAMP));
+    return mess.type;
+}
+
+// see header
+u8 parse_message(char* text, int size, Buffer* into) {
+    assert(text and into);
+    int prev_size = into->size();
+
+    if (messages_parser == PARSER_STREAM) {
+        xml_parser.parse(text);
+        return emit_message(xml_parser, into);
     }
+
+    // pugi gets its memory from behind the end of memory_for_messages, which must not relocate
+    // while the document exists.
+    int memory_size = memory_for_messages.size();
+    bool trap = memory_for_messages.trap_alloc();
+    memory_for_messages.trap_alloc(true);
+    u8 result;
     {
         pugi::xml_document doc;
-        assert(doc.load_buffer_inplace(memory_for_messages.data(), memory_for_messages.size()));
+        assert(doc.load_buffer_inplace(text, size));
 
         auto xml_mess = doc.child("message");
         auto type = xml_mess.attribute("type").value();
 
-        int prev_size = into->size();
-	
         if (std::strcmp(type, "auth-response") == 0) {
             parse_auth_response(xml_mess.child("auth-response"), into);
         } else if (std::strcmp(type, "sim-start") == 0) {
@@ -641,8 +1332,157 @@ u8 get_next_message(Socket& sock, Buffer* into) {
 
         auto& mess = into->get<Message_Server2Client>(prev_size);
         narrow(mess.timestamp, xml_mess.attribute("timestamp").as_ullong());
-        memory_for_messages.trap_alloc(false);
-        return mess.type;
+        result = mess.type;
+    }
+    memory_for_messages.resize(memory_size);
+    memory_for_messages.trap_alloc(trap);
+    return result;
+}
+
+// see header
+void Parse_pool::init(int threads, int job_count) {
+    assert(threads > 0 and job_count > 0 and workers.empty());
+    jobs.resize(job_count);
+    for (int i = 0; i < threads; ++i) {
+        workers.emplace_back(&Parse_pool::worker_main, this);
+    }
+}
+
+Parse_pool::~Parse_pool() {
+    {
+        std::lock_guard<std::mutex> lock {mutex};
+        stopping = true;
+    }
+    work_available.notify_all();
+    for (auto& i: workers) {
+        i.join();
+    }
+}
+
+void Parse_pool::worker_main() {
+    ids_lookup_only = true;
+    std::unique_lock<std::mutex> lock {mutex};
+    while (true) {
+        work_available.wait(lock, [this]() { return stopping or queue_next < queue.size(); });
+        if (stopping) return;
+        Job& job = jobs[queue[queue_next++]];
+        lock.unlock();
+
+        job.result.reset();
+        job.missing_ids.reset();
+        ids_missing = false;
+        ids_missing_strings = &job.missing_ids;
+        if (not job.parsed) {
+            job.parser.parse(job.text);
+            job.parsed = true;
+        }
+        job.type = emit_message(job.parser, &job.result);
+        job.ids_missing = ids_missing;
+        ids_missing_strings = nullptr;
+
+        lock.lock();
+        ++finished;
+        work_done.notify_all();
+    }
+}
+
+/**
+ * Register the ids of the auctions, jobs, missions and posted jobs in the text of a percept, in the
+ * same order as parse_perception. Ids that are quoted differently or contain entities are left to
+ * the parser.
+ */
+static void register_job_ids(char const* text) {
+    for (char const* tag: {"<auction ", "<job ", "<mission ", "<posted "}) {
+        for (char const* i = std::strstr(text, tag); i; i = std::strstr(i + 1, tag)) {
+            char const* end = std::strchr(i, '>');
+            if (not end) return;
+            for (char const* j = i; j + 5 <= end; ++j) {
+                if (std::strncmp(j, " id=\"", 5) != 0) continue;
+                char const* begin = j + 5;
+                char const* quote = std::strchr(begin, '"');
+                if (quote and quote < end and not std::memchr(begin, '&', quote - begin)) {
+                    register_id16(Buffer_view {begin, (int)(quote - begin)});
+                }
+                break;
+            }
+        }
+    }
+}
+
+// see header
+void Parse_pool::submit(int index, char* text) {
+    assert(0 <= index and index < (int)jobs.size());
+    assert(text and not jobs[index].submitted);
+    if (submitted == 0) {
+        // No job is running, so strings may be registered. The percepts of a team have the same
+        // jobs, so one of them is enough.
+        register_job_ids(text);
+    }
+    {
+        std::lock_guard<std::mutex> lock {mutex};
+        Job& job = jobs[index];
+        job.text = text;
+        job.submitted = true;
+        queue.push_back(index);
+        ++submitted;
+    }
+    work_available.notify_one();
+}
+
+void Parse_pool::wait_finished() {
+    std::unique_lock<std::mutex> lock {mutex};
+    work_done.wait(lock, [this]() { return finished == submitted; });
+    queue.reset();
+    queue_next = 0;
+    finished = 0;
+    submitted = 0;
+}
+
+// see header
+void Parse_pool::finish(Buffer* into) {
+    assert(into);
+    wait_finished();
+
+    // Register the new strings here, in the order of the jobs, so that the ids are the same as with
+    // a single thread. Then the workers write those messages again, the text has been parsed already.
+    bool again = false;
+    {
+        std::lock_guard<std::mutex> lock {mutex};
+        for (int i = 0; i < (int)jobs.size(); ++i) {
+            Job& job = jobs[i];
+            if (not job.submitted or not job.ids_missing) continue;
+            for (int j = 0; j < job.missing_ids.size();) {
+                u8 id_size = job.missing_ids[j];
+                Buffer_view str {job.missing_ids.data() + j + 1};
+                if (id_size == sizeof(u8)) {
+                    register_id(str);
+                } else {
+                    register_id16(str);
+                }
+                j += str.size() + 2;
+            }
+            queue.push_back(i);
+            ++submitted;
+            again = true;
+        }
+    }
+    if (again) {
+        work_available.notify_all();
+        wait_finished();
+    }
+
+    for (Job& job: jobs) {
+        if (not job.submitted) continue;
+        if (job.ids_missing) {
+            // All the strings the workers found missing are registered, so this should not happen
+            job.result.reset();
+            job.type = emit_message(job.parser, &job.result);
+        }
+        job.offset = into->size();
+        into->append(job.result);
+        job.end = into->size();
+        job.parsed = false;
+        job.submitted = false;
     }
 }
 
@@ -662,6 +1502,12 @@ pugi::xml_node prep_message_xml(Message const& mess, pugi::xml_document* into,
 void send_xml_message(Socket& sock, pugi::xml_document& doc) {
 	Socket_writer writer {&sock};
 	doc.save(writer, "", pugi::format_default, pugi::encoding_utf8);
+    if (traffic_output.is_open()) {
+        std::ostringstream text;
+        doc.save(text, "", pugi::format_default, pugi::encoding_utf8);
+        text << '\0';
+        write_traffic_record(Traffic_record::OUTGOING, sock, text.str());
+    }
     if (dump_xml_output) {
         *dump_xml_output << ">>> outgoing " << sock.get_id() << " >>>\n";
         doc.save(*dump_xml_output);
@@ -683,7 +1529,8 @@ void send_message(Socket& sock, Message_Auth_Request const& mess) {
 }
 
 // see header
-void send_message(Socket& sock, Message_Action const& mess) {
+void write_message_pugi(Message_Action const& mess, Buffer* into) {
+    assert(into);
     memory_for_messages.trap_alloc(true);
     {
         pugi::xml_document doc;    
@@ -763,12 +1610,185 @@ void send_message(Socket& sock, Message_Action const& mess) {
 		}
 #undef next_arg
 #undef cast
-        send_xml_message(sock, doc);
+        Buffer_writer writer {into};
+        doc.save(writer, "", pugi::format_default, pugi::encoding_utf8);
+        into->append("", 1);
     }
     memory_for_messages.trap_alloc(false);
     memory_for_messages.reset();
 }
 
+/**
+ * Writes xml directly into a Buffer. The output is the same as that of pugixml with the options
+ * used for sending (no indentation, one node per line), so that the server sees no difference.
+ */
+struct Xml_writer {
+	Buffer* out;
+	// Whether the start tag of the current element still needs its closing >
+	bool tag_open = false;
+
+	void raw(Buffer_view str) { out->append(str.data(), str.size()); }
+
+	// Append str, escaping the characters pugixml escapes in text or attribute values.
+	void escaped(Buffer_view str, bool attribute) {
+		char const* begin = str.begin();
+		for (char const* i = str.begin(); i != str.end(); ++i) {
+			u8 c = *i;
+			bool special = c < 32 ? c != '\t' and (attribute or (c != '\r' and c != '\n'))
+				: c == '&' or c == '<' or c == '>' or (attribute and c == '"');
+			if (not special) continue;
+
+			out->append(begin, i - begin);
+			begin = i + 1;
+			switch (c) {
+			case '&': raw("&amp;"); break;
+			case '<': raw("&lt;"); break;
+			case '>': raw("&gt;"); break;
+			case '"': raw("&quot;"); break;
+			default: {
+				char ref[] = {'&', '#', (char)('0' + c / 10), (char)('0' + c % 10), ';'};
+				out->append(ref, sizeof(ref));
+			} break;
+			}
+		}
+		out->append(begin, str.end() - begin);
+	}
+
+	void value(Buffer_view str) { escaped(str, false); }
+	void value(int val)      { number("%d", val); }
+	void value(unsigned val) { number("%u", val); }
+	void value(double val)   { number("%.17g", val); }
+
+	template <typename T>
+	void number(char const* format, T val) {
+		char buf[32];
+		int n = std::snprintf(buf, sizeof(buf), format, val);
+		assert(0 < n and n < (int)sizeof(buf));
+		out->append(buf, n);
+	}
+
+	// Add a <p> child containing val to the current element
+	template <typename T>
+	void arg(T val) {
+		if (tag_open) {
+			raw(">\n");
+			tag_open = false;
+		}
+		raw("<p>");
+		value(val);
+		raw("</p>\n");
+	}
+};
+
+// see header
+void write_message(Message_Action const& mess, Buffer* into) {
+	assert(into);
+	Xml_writer out {into};
+	out.raw("<?xml version=\"1.0\" encoding=\"UTF-8\" standalone=\"no\"?>\n"
+		"<message type=\"action\">\n<action id=\"");
+	out.value((int)mess.id);
+	out.raw("\" type=\"");
+	out.escaped(Action::get_name(mess.action->type), true);
+	out.raw("\"");
+	out.tag_open = true;
+
+	Action const& action = *mess.action;
+
+#define next_arg(x) out.arg(x)
+#define cast(T) auto const& a = (T const&) action
+
+	switch (mess.action->type) {
+	case Action::GIVE: {
+		cast(Action_Give);
+		next_arg(get_string_from_id(a.agent));
+		next_arg(get_string_from_id(a.item.id));
+		next_arg(a.item.amount);
+	} break;
+	case Action::STORE:
+	case Action::RETRIEVE:
+	case Action::RETRIEVE_DELIVERED:
+	case Action::BUY:
+	case Action::DUMP: {
+		cast(Action_Store);
+		next_arg(get_string_from_id(a.item.id));
+		next_arg(a.item.amount);
+	} break;
+	case Action::ASSEMBLE:
+	case Action::ASSIST_ASSEMBLE:
+	case Action::GOTO1: {
+		cast(Action_Assemble);
+		next_arg(get_string_from_id(a.item));
+	} break;
+	case Action::DELIVER_JOB: {
+		cast(Action_Deliver_job);
+		next_arg(get_string_from_id(a.job));
+	} break;
+	case Action::BID_FOR_JOB: {
+		cast(Action_Bid_for_job);
+		next_arg(get_string_from_id(a.job));
+		next_arg(a.bid);
+	} break;
+	case Action::POST_JOB: {
+		cast(Action_Post_job);
+		next_arg(a.reward);
+		next_arg(a.duration);
+		next_arg(a.storage);
+		for (Item_stack i : a.items) {
+			next_arg(i.item);
+			next_arg(i.amount);
+		}
+	} break;
+	case Action::GOTO2: {
+		cast(Action_Goto2);
+		auto const back = current_map_graph->get_pos_back(a.pos);
+		next_arg(back.first);
+		next_arg(back.second);
+	} break;
+	case Action::RECEIVE:
+	case Action::CHARGE:
+	case Action::RECHARGE:
+	case Action::CONTINUE:
+	case Action::SKIP:
+	case Action::ABORT:
+	case Action::GATHER:
+	case Action::GOTO0:
+		break;
+	case Action::GOTO:
+	case Action::UNKNOWN_ACTION:
+	case Action::RANDOM_FAIL:
+	case Action::NO_ACTION:
+	default:
+		assert(false);
+	}
+#undef next_arg
+#undef cast
+
+	out.raw(out.tag_open ? " />\n" : "</action>\n");
+	out.raw("</message>\n");
+	into->append("", 1);
+}
+
+// see header
+void prepare_message(Socket& sock, Message_Action const& mess) {
+	Buffer& buffer = sock.send_buffer;
+	buffer.reset();
+	write_message(mess, &buffer);
+	if (traffic_output.is_open()) {
+		write_traffic_record(Traffic_record::OUTGOING, sock, buffer);
+	}
+	if (dump_xml_output) {
+		*dump_xml_output << ">>> outgoing " << sock.get_id() << " >>>\n";
+		dump_xml_output->write(buffer.data(), buffer.size() - 1);
+		*dump_xml_output << '\n';
+	}
+}
+
+// see header
+void send_message(Socket& sock, Message_Action const& mess) {
+	prepare_message(sock, mess);
+	sock.send(sock.send_buffer);
+}
+
 } /* end of namespace jup */
 
 int messages_main() {
@@ -4,6 +4,7 @@
 #include "objects.hpp"
 #include "sockets.hpp"
 #include "graph.hpp"
+#include "xml_parser.hpp"
 
 namespace jup {
 
@@ -95,8 +96,43 @@ struct Message_Request_Action: Message_Server2Client {
  */
 void init_messages(std::ostream* _dump_xml_output = nullptr);
 
+/**
+ * A recording of the traffic (see record_traffic) is a sequence of these, each followed by the
+ * text of the message, including the terminating zero.
+ */
+struct Traffic_record {
+	enum Direction: u8 {
+		INCOMING, OUTGOING
+	};
+
+	u8 direction;
+	u8 unused = 0;
+	u16 socket; // see Socket::get_id
+	u32 size;   // of the text
+	u64 time;   // Microseconds since the recording was started
+};
+
+/**
+ * Record all messages that are sent or received from now on into the file, with the socket and the
+ * time. Incoming messages are recorded when they are taken out of the receive buffer, outgoing
+ * ones when they are written. The file is buffered, flush_traffic_recording writes it out. Mode
+ * serve plays these recordings back. The records are not aligned in the file.
+ */
+void record_traffic(Buffer_view path);
+void flush_traffic_recording();
+
 void set_messages_graph(Graph* graph);
 
+/**
+ * Choose how incoming messages are parsed. PARSER_STREAM uses Xml_parser and writes the messages
+ * directly, PARSER_PUGI builds a pugixml document first. Both produce the same messages, the
+ * latter is kept for comparison. The default is PARSER_STREAM.
+ */
+enum Messages_parser: u8 {
+	PARSER_STREAM, PARSER_PUGI
+};
+void set_messages_parser(u8 parser);
+
 u8  register_id  (Buffer_view str);
 u16 register_id16(Buffer_view str);
 
@@ -114,6 +150,13 @@ u16 get_id_from_string16(Buffer_view str);
  */
 Buffer_view get_string_from_id(u8  id);
 Buffer_view get_string_from_id(u16 id);
+
+/**
+ * Append the mapping of strings to ids to the Buffer, or restore the mapping from data written
+ * like that. This is used to capture and replay situations.
+ */
+void save_string_ids(Buffer* into);
+void load_string_ids(Buffer_view data);
     
 /**
  * Writes the next message in the Socket into the end of the Buffer. Returns the
@@ -121,6 +164,112 @@ Buffer_view get_string_from_id(u16 id);
  */
 u8 get_next_message(Socket& sock, Buffer* into);
 
+/**
+ * Read the data that is available on the socket into its receive buffer. This does not block if
+ * the socket is readable (see wait_readable).
+ */
+void receive_available(Socket& sock);
+
+/**
+ * Whether a complete message has been received on the socket, so that get_next_message does not
+ * block.
+ */
+bool message_buffered(Socket const& sock);
+
+/**
+ * Take the next complete message out of the receive buffer of the socket, without parsing it.
+ * Returns whether there was one. The text is zero-terminated, and stays valid until data is read
+ * from the socket again. size includes the zero.
+ */
+bool take_message_text(Socket& sock, char** text, int* size);
+
+/**
+ * Parses messages on a pool of worker threads, using the streaming parser. Each job has its own
+ * Xml_parser and output Buffer, which are reused. The results are appended in the order of the
+ * jobs, not in the order they were submitted or finished, so this can be used to parse the
+ * percepts of all agents in parallel.
+ *
+ * The workers cannot register new strings, as that would modify the mapping of all threads and make
+ * the ids depend on the timing. Instead they record the strings they did not find. finish registers
+ * them on the calling thread, in the order of the jobs, and then has the workers write those
+ * messages again. The ids of new jobs are the only new strings in most steps, so submit registers
+ * them itself while no job is running. While jobs are running, no other thread may register strings.
+ */
+struct Parse_pool {
+	struct Job {
+		char* text = nullptr;
+		Xml_parser parser;
+		Buffer result;
+		u8 type;
+		bool ids_missing;
+		// The strings not found while writing the message, each one zero-terminated and preceded by
+		// the size of its id in bytes
+		Buffer missing_ids;
+		// Whether the text is parsed already, so that only the message has to be written
+		bool parsed = false;
+		bool submitted = false;
+		// The position of the message after finish
+		int offset;
+		int end;
+	};
+
+	void init(int threads, int job_count);
+	~Parse_pool();
+
+	explicit operator bool() const { return workers.size(); }
+
+	/**
+	 * Start parsing the text (see take_message_text) as job index. It must remain valid until
+	 * finish is called.
+	 */
+	void submit(int index, char* text);
+
+	/**
+	 * Wait for the submitted jobs and append their messages to into, in the order of the jobs.
+	 * Afterwards, jobs[index].offset and end give their position.
+	 */
+	void finish(Buffer* into);
+
+	std::vector<Job> jobs;
+
+private:
+	void worker_main();
+	void wait_finished();
+
+	std::vector<std::thread> workers;
+	std::mutex mutex;
+	std::condition_variable work_available;
+	std::condition_variable work_done;
+	Array<int> queue;
+	int queue_next = 0;
+	int submitted = 0;
+	int finished = 0;
+	bool stopping = false;
+};
+
+/**
+ * The sections of a percept after self and team (entities, facilities, jobs and so on) are the same
+ * for all agents of a team. When the streaming parser reads a percept whose shared sections are
+ * equal to those of a percept it parsed earlier in the same step, it copies what was written for
+ * them instead of parsing them again. The percepts stay self-contained, so this saves time but not
+ * space. These are the statistics of that, summed up since they were last reset.
+ */
+struct Shared_section_stats {
+	int parsed = 0; // Percepts whose shared sections were parsed
+	int reused = 0; // Percepts whose shared sections were copied
+	s64 bytes_reused = 0;
+	double parse_time = 0.0;    // Time spent parsing the shared sections
+	double overhead_time = 0.0; // Time spent hashing all of them and copying the reused ones
+};
+Shared_section_stats get_shared_section_stats(bool reset = false);
+
+/**
+ * Parse the xml message in text, which must be zero-terminated and is modified, and append it to
+ * the Buffer. size is the length of the text, including the zero. Returns the type of the
+ * Message. This is used by get_next_message, and on its own to parse recorded messages.
+ */
+u8 parse_message(char* text, int size, Buffer* into);
+
 /**
  * Writes the next message in the Socket into the end of the Buffer. Returns the
  * Message if it is of the specified type, else the behaviour is undefined.
@@ -136,11 +285,26 @@ T& get_next_message_ref(Socket& sock, Buffer* into) {
 }
 
 /**
- * Send a message into the socket.
+ * Send a message into the socket. Actions are written directly into the send buffer of the socket
+ * (see write_message) and sent with a single call.
  */
 void send_message(Socket& sock, Message_Auth_Request const& mess);
 void send_message(Socket& sock, Message_Action const& mess);
 
+/**
+ * Write the action into the send buffer of the socket, like send_message, but do not send it. This
+ * is used to send the actions of all agents at once, see Socket_sender.
+ */
+void prepare_message(Socket& sock, Message_Action const& mess);
+
+/**
+ * Append the xml of the action to the Buffer, including the terminating zero. write_message does
+ * not allocate apart from growing the Buffer, write_message_pugi builds a pugixml document first.
+ * The output of both is the same, the latter is kept for comparison.
+ */
+void write_message(Message_Action const& mess, Buffer* into);
+void write_message_pugi(Message_Action const& mess, Buffer* into);
+
 void reset_messages();
 
 } /* end of namespace jup */
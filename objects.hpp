@@ -326,6 +326,7 @@ struct Resource_node: Facility {
 
 struct Percept {
 	u64 deadline;
+	u64 timestamp; // Server time the percept was sent, same clock as deadline
 	u16 id;
 	u16 simulation_step;
 	s32 team_money;
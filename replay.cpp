@@ -0,0 +1,553 @@
+#include "replay.hpp"
+
+#include "agent2.hpp"
+#include "debug.hpp"
+#include "messages.hpp"
+#include "server.hpp"
+#include "system.hpp"
+
+namespace jup {
+
+void Capture_writer::open(Buffer_view path) {
+    out.open(path.c_str(), std::ios::out | std::ios::binary);
+    if (not out) {
+        jerr << "Warning: Could not open the capture file " << path.c_str()
+             << ", nothing will be captured.\n";
+    }
+}
+
+void Capture_writer::write(u32 type, Buffer_view data) {
+    u32 size = data.size();
+    out.write((char const*)&type, sizeof(type));
+    out.write((char const*)&size, sizeof(size));
+    out.write(data.data(), data.size());
+}
+
+void Capture_writer::write_step(Buffer const& world, Buffer const& sit, Buffer const& sit_old) {
+    scratch.reset();
+    save_string_ids(&scratch);
+    write(STRINGS, scratch);
+    write(WORLD, world);
+    write(SIT, sit);
+    write(SIT_OLD, sit_old);
+    // The capture should be usable even if the match is aborted
+    out.flush();
+}
+
+static void print_stats(Search_stats const& s) {
+    auto phase = [&s](char const* name, double time) {
+        jout << "  " << name << ": " << time << "s (" << (int)(time / s.total * 100.0) << "%)\n";
+    };
+    phase("prepare     ", s.prepare);
+    phase("fast_forward", s.fast_forward);
+    phase("create_work ", s.create_work);
+    phase("fix_errors  ", s.fix_errors);
+    phase("optimize    ", s.optimize);
+    phase("rate        ", s.rate);
+}
+
+template <int N>
+static int replay_team(Server* server, Server_options const& options, Buffer const& file) {
+    Mothership_team<N> mothership;
+    mothership.search_iterations = options.replay_iterations;
+    mothership.search_mode = options.search_mode;
+    Graph* graph = nullptr;
+
+    Search_stats sum;
+    double rating_sum = 0;
+    int steps = 0;
+
+    int offset = 0;
+    while (offset < file.size()) {
+        if (offset + 2 * (int)sizeof(u32) > file.size()) {
+            jerr << "Warning: The capture file is truncated.\n";
+            break;
+        }
+        u32 type = file.get<u32>(offset);
+        u32 size = file.get<u32>(offset + sizeof(u32));
+        offset += 2 * sizeof(u32);
+        if (offset + (int)size > file.size()) {
+            jerr << "Warning: The capture file is truncated.\n";
+            break;
+        }
+        Buffer_view data {file.data() + offset, (int)size};
+        offset += size;
+
+        if (type == Capture_writer::MAP) {
+            graph = server->find_graph(data);
+            if (not graph) {
+                jerr << "Error: Could not find map " << data << '\n';
+                return 2;
+            }
+            set_messages_graph(graph);
+            mothership.init(graph);
+        } else if (type == Capture_writer::TEAM) {
+            // Already handled by replay_main
+        } else if (type == Capture_writer::STRINGS) {
+            load_string_ids(data);
+        } else if (type == Capture_writer::WORLD) {
+            assert(graph);
+            mothership.world_buffer.reset();
+            mothership.world_buffer.append(data);
+            mothership.world().graph = graph;
+        } else if (type == Capture_writer::SIT) {
+            mothership.sit_buffer.reset();
+            mothership.sit_buffer.append(data);
+        } else if (type == Capture_writer::SIT_OLD) {
+            mothership.sit_old_buffer.reset();
+            mothership.sit_old_buffer.append(data);
+
+            // The step is complete
+            mothership.on_request_action();
+
+            auto const& s = mothership.search_stats;
+            sum.prepare      += s.prepare;
+            sum.fast_forward += s.fast_forward;
+            sum.create_work  += s.create_work;
+            sum.fix_errors   += s.fix_errors;
+            sum.optimize     += s.optimize;
+            sum.rate         += s.rate;
+            sum.total        += s.total;
+            sum.strategies   += s.strategies;
+            sum.strategy_bytes += s.strategy_bytes;
+            sum.best_rating   = s.best_rating;
+            rating_sum       += s.best_rating;
+            ++steps;
+        } else {
+            jerr << "Error: Invalid record in capture file, type " << type << '\n';
+            return 3;
+        }
+    }
+
+    if (steps == 0) {
+        jerr << "Error: The capture file does not contain any steps.\n";
+        return 3;
+    }
+
+    jout << "\nReplayed " << steps << " steps with " << options.replay_iterations
+         << " iterations each, searched " << sum.strategies << " strategies in " << sum.total
+         << "s (" << sum.strategies / sum.total << " strategies/s)\n";
+    print_stats(sum);
+    jout << "Memory per strategy: " << sum.strategy_bytes / std::max(sum.strategies, 1)
+         << " bytes, unpacked " << sizeof(Strategy<N>) << " bytes\n";
+    // steps is nonzero, see above
+    double rating_avg = rating_sum / steps;
+    jout << "Best rating in the last step: " << sum.best_rating << ", on average " << rating_avg;
+    if (sum.total > 0) {
+        jout << " (" << rating_avg / (sum.total / steps) << " per second of search)";
+    }
+    jout << endl;
+    return 0;
+}
+
+int replay_main(Server* server, Server_options const& options) {
+    assert(server);
+
+    Buffer file;
+    file.read_from_file(options.capture_file);
+
+    // Find the team size, which decides the layout of the situations
+    u32 team_size = number_of_agents;
+    for (int offset = 0; offset + 2 * (int)sizeof(u32) <= file.size();) {
+        u32 type = file.get<u32>(offset);
+        u32 size = file.get<u32>(offset + sizeof(u32));
+        offset += 2 * sizeof(u32);
+        if (type == Capture_writer::TEAM and size == sizeof(u32) and offset + (int)size <= file.size()) {
+            team_size = file.get<u32>(offset);
+            break;
+        }
+        offset += size;
+    }
+
+    switch (team_size) {
+    case 16: return replay_team<16>(server, options, file);
+    case 20: return replay_team<20>(server, options, file);
+    case 28: return replay_team<28>(server, options, file);
+    default:
+        jerr << "Error: Invalid team size " << team_size << " in capture file\n";
+        return 3;
+    }
+}
+
+/**
+ * Write a description of the message at the start of buf, which does not depend on padding.
+ */
+static void describe_message(Buffer const& buf, u8 type, std::ostream& into) {
+    Debug_ostream out {into};
+    if (type == Message::SIM_START) {
+        out < buf.get<Message_Sim_Start>().simulation;
+    } else if (type == Message::REQUEST_ACTION) {
+        out < buf.get<Message_Request_Action>().perception;
+    } else if (type == Message::SIM_END) {
+        auto const& mess = buf.get<Message_Sim_End>();
+        out < mess.ranking < mess.score;
+    } else if (type == Message::AUTH_RESPONSE) {
+        out < buf.get<Message_Auth_Response>().succeeded;
+    }
+    out < buf.get<Message_Server2Client>().timestamp;
+}
+
+int parse_bench_main(Server* server, Server_options const& options) {
+    assert(server);
+    constexpr int rounds = 10;
+
+    Buffer file;
+    file.read_from_file(options.dump_xml);
+    file.append("", 1);
+
+    // Collect the incoming messages of the dump, each one zero-terminated
+    Buffer texts;
+    Array<int> offsets;
+    auto is_header = [](char const* line) {
+        return std::strncmp(line, "<<< incoming ", 13) == 0
+            or std::strncmp(line, ">>> outgoing ", 13) == 0;
+    };
+    for (char const* line = file.data(); *line;) {
+        char const* line_end = std::strchr(line, '\n');
+        if (not line_end) break;
+        if (std::strncmp(line, "<<< incoming ", 13) != 0) {
+            line = line_end + 1;
+            continue;
+        }
+        char const* begin = line_end + 1;
+        char const* end = begin;
+        while (*end and not (end[-1] == '\n' and is_header(end))) {
+            end = std::strchr(end, '\n');
+            end = end ? end + 1 : file.end() - 1;
+        }
+        line = end;
+        while (end > begin and (end[-1] == '\n' or end[-1] == '\r')) --end;
+        offsets.push_back(texts.size());
+        texts.append(begin, end - begin);
+        texts.append("", 1);
+    }
+    offsets.push_back(texts.size());
+
+    if (offsets.size() <= 1) {
+        jerr << "Error: The dump file does not contain any incoming messages.\n";
+        return 3;
+    }
+    int messages = offsets.size() - 1;
+
+    u8 parsers[] = {PARSER_PUGI, PARSER_STREAM};
+    char const* parser_names[] = {"pugixml", "stream "};
+    std::vector<std::string> expected;
+    Buffer scratch;
+    Buffer into;
+
+    for (int p = 0; p < 2; ++p) {
+        set_messages_parser(parsers[p]);
+        get_shared_section_stats(true);
+        double time = 0;
+        for (int round = 0; round < rounds; ++round) {
+            for (int i = 0; i < messages; ++i) {
+                int size = offsets[i + 1] - offsets[i];
+                scratch.reset();
+                scratch.append(texts.data() + offsets[i], size);
+                into.reset();
+
+                double time_begin = elapsed_time();
+                u8 type = parse_message(scratch.data(), size, &into);
+                time += elapsed_time() - time_begin;
+
+                if (round) continue;
+
+                if (type == Message::SIM_START) {
+                    auto name = get_string_from_id(into.get<Message_Sim_Start>().simulation.map);
+                    Graph* graph = server->find_graph(name);
+                    if (not graph) {
+                        jerr << "Error: Could not find map " << name << '\n';
+                        return 2;
+                    }
+                    set_messages_graph(graph);
+                }
+
+                std::ostringstream description;
+                describe_message(into, type, description);
+                if (p == 0) {
+                    expected.push_back(description.str());
+                } else if (expected[i] != description.str()) {
+                    jerr << "Error: The parsers disagree on message " << i << ":\n  pugixml: "
+                         << expected[i] << "\n  stream:  " << description.str() << '\n';
+                    return 4;
+                }
+            }
+        }
+        double bytes = (double)texts.size() * rounds;
+        jout << "Parser " << parser_names[p] << ": " << time / (messages * rounds) * 1e6
+             << "us per message, " << bytes / time / (1024.0 * 1024.0) << " MiB/s\n";
+        auto shared = get_shared_section_stats(true);
+        if (shared.parsed) {
+            jout << "  shared sections of " << shared.reused << " percepts copied from one of "
+                 << shared.parsed << " parsed ones, " << nice_bytes(shared.bytes_reused) << " in total\n";
+        }
+    }
+    jout << "Parsed " << messages << " messages (" << nice_bytes(texts.size()) << ") "
+         << rounds << " times, the results are identical." << endl;
+    return 0;
+}
+
+/**
+ * Answer each message received on sock with reply, until the empty message arrives.
+ */
+static void socket_bench_serve(Socket* sock, Buffer const* reply) {
+    Socket_poller poller;
+    poller.init();
+    assert(poller);
+    poller.add(*sock, 0);
+
+    while (true) {
+        char* text;
+        int size;
+        while (not take_message_text(*sock, &text, &size)) {
+            int tag;
+            if (poller.wait(&tag, 1) != 1) return;
+            receive_available(*sock);
+        }
+        if (size == 1) return;
+        sock->send(*reply);
+    }
+}
+
+/**
+ * Receive and drop the messages on all of the sockets, until the empty message arrives on one.
+ */
+static void socket_bench_drain(Socket* socks, int count) {
+    Socket_poller poller;
+    poller.init();
+    assert(poller);
+    for (int i = 0; i < count; ++i) {
+        poller.add(socks[i], i);
+    }
+
+    Array<int> tags;
+    tags.resize(count);
+    while (true) {
+        int ready = poller.wait(tags.data(), count);
+        if (ready < 0) return;
+        for (int i = 0; i < ready; ++i) {
+            Socket& sock = socks[tags[i]];
+            receive_available(sock);
+            char* text;
+            int size;
+            while (take_message_text(sock, &text, &size)) {
+                if (size == 1) return;
+            }
+        }
+    }
+}
+
+/**
+ * Sort the times and print their distribution.
+ */
+static void print_times(char const* name, Array<double>& times) {
+    std::sort(times.begin(), times.end());
+    double sum = 0.0;
+    for (double i: times) sum += i;
+    int count = times.size();
+    jout << name << " median " << times[count / 2] * 1e6 << "us, 99th percentile "
+         << times[count * 99 / 100] * 1e6 << "us, maximum " << times.back() * 1e6 << "us, mean "
+         << sum / count * 1e6 << "us\n";
+}
+
+int socket_bench_main(Server_options const& options) {
+    constexpr int round_trips = 2000;
+    // Roughly the size of a percept of the server
+    constexpr int reply_size = 16 * 1024;
+    // The largest team, for sending the actions of a step
+    constexpr int team_size = 28;
+    constexpr int team_steps = 1000;
+
+    Socket_listener listener;
+    listener.init("0");
+    if (not listener) {
+        jerr << "Error: Could not listen on the loopback interface.\n";
+        return 2;
+    }
+    char port[16];
+    std::snprintf(port, sizeof(port), "%d", listener.port());
+
+    Buffer reply;
+    reply.reserve_space(reply_size);
+    std::memset(reply.data(), 'x', reply_size - 1);
+    reply.data()[reply_size - 1] = 0;
+    reply.addsize(reply_size);
+
+    Buffer action_buffer;
+    action_buffer.reserve_space(256);
+    auto& action = action_buffer.emplace_back<Message_Action>((u16)0, Action_Skip {}, &action_buffer);
+
+    Array<double> times;
+    for (bool no_delay: {false, true}) {
+        Socket_options sock_options = options.socket_options;
+        sock_options.no_delay = no_delay;
+
+        Socket client {"127.0.0.1", port, sock_options};
+        Socket peer;
+        if (not client or not listener.accept(&peer, sock_options)) {
+            jerr << "Error: Could not connect over the loopback interface.\n";
+            return 2;
+        }
+        std::thread server_thread {socket_bench_serve, &peer, &reply};
+
+        times.reset();
+        for (int i = 0; i < round_trips; ++i) {
+            double time_begin = elapsed_time();
+            send_message(client, action);
+            char* text;
+            int size;
+            while (not take_message_text(client, &text, &size)) {
+                Socket* sock = &client;
+                bool readable;
+                assert(wait_readable(&sock, 1, &readable) == 1);
+                receive_available(client);
+            }
+            times.push_back(elapsed_time() - time_begin);
+        }
+        client.send({"", 1});
+        server_thread.join();
+
+        print_times(no_delay ? "TCP_NODELAY on: " : "TCP_NODELAY off:", times);
+    }
+    jout << "Measured " << round_trips << " round trips of an action and a reply of "
+         << nice_bytes(reply_size) << " each.\n";
+
+    // Send the actions of a team like Server::run_simulation, alternating between sending them
+    // one after the other and as a batch
+    Socket clients[team_size];
+    Socket peers[team_size];
+    Socket* client_ptrs[team_size];
+    for (int i = 0; i < team_size; ++i) {
+        clients[i].init("127.0.0.1", port, options.socket_options);
+        if (not clients[i] or not listener.accept(&peers[i], options.socket_options)) {
+            jerr << "Error: Could not connect over the loopback interface.\n";
+            return 2;
+        }
+        prepare_message(clients[i], action);
+        client_ptrs[i] = &clients[i];
+    }
+    std::thread drain_thread {socket_bench_drain, peers, team_size};
+
+    Socket_sender sender;
+    sender.init(team_size);
+    Array<double> times_batched;
+    times.reset();
+    for (int step = 0; step < team_steps; ++step) {
+        double time_begin = elapsed_time();
+        for (Socket& i: clients) {
+            i.send(i.send_buffer);
+        }
+        double time_mid = elapsed_time();
+        sender.send_buffers(client_ptrs, team_size);
+        times.push_back(time_mid - time_begin);
+        times_batched.push_back(elapsed_time() - time_mid);
+    }
+    clients[0].send({"", 1});
+    drain_thread.join();
+
+    print_times("One after the other:", times);
+    print_times(sender.batched ? "In one batch:       " : "In one batch (not available):", times_batched);
+    jout << "Measured sending an action over each of " << team_size << " connections, "
+         << team_steps << " times." << endl;
+    return 0;
+}
+
+int serve_main(Server_options const& options) {
+    Buffer file;
+    file.read_from_file(options.record_file);
+
+    // The sockets are identified by the order they were connected in
+    int socket_max = 0;
+    int records = 0;
+    Traffic_record record;
+    for (int offset = 0; offset + (int)sizeof(Traffic_record) <= file.size();) {
+        std::memcpy(&record, file.data() + offset, sizeof(record));
+        socket_max = std::max(socket_max, (int)record.socket);
+        offset += sizeof(Traffic_record) + record.size;
+        ++records;
+    }
+    if (records == 0) {
+        jerr << "Error: The recording does not contain any messages.\n";
+        return 3;
+    }
+
+    Socket_listener listener;
+    listener.init(options.host_port ? options.host_port : "12300");
+    if (not listener) {
+        jerr << "Error: Could not listen on the loopback interface.\n";
+        return 2;
+    }
+    jout << "Listening on port " << listener.port() << ", the recording contains " << records
+         << " messages of " << socket_max << " connections." << endl;
+
+    std::vector<Socket> sockets (socket_max + 1);
+    int connected = 0;
+    int sent = 0;
+    int received = 0;
+    double time_begin = elapsed_time();
+
+    // When the last message of an agent was received, and when it was recorded
+    double anchor_time = time_begin;
+    u64 anchor_record = 0;
+
+    int offset = 0;
+    while (offset + (int)sizeof(Traffic_record) <= file.size()) {
+        std::memcpy(&record, file.data() + offset, sizeof(record));
+        char const* text = file.data() + offset + sizeof(Traffic_record);
+        offset += sizeof(Traffic_record) + record.size;
+        if (offset > file.size()) {
+            jerr << "Warning: The recording is truncated.\n";
+            break;
+        }
+        Socket& sock = sockets[record.socket];
+
+        if (record.direction == Traffic_record::OUTGOING) {
+            if (not sock.is_valid()) {
+                if (not listener.accept(&sock, options.socket_options)) {
+                    jerr << "Error: Could not accept a connection.\n";
+                    return 2;
+                }
+                ++connected;
+            }
+
+            char* reply;
+            int size;
+            while (not take_message_text(sock, &reply, &size)) {
+                Socket* sock_ptr = &sock;
+                bool readable;
+                if (wait_readable(&sock_ptr, 1, &readable) == -1) {
+                    return 2;
+                }
+                receive_available(sock);
+            }
+            anchor_time = elapsed_time();
+            anchor_record = record.time;
+            ++received;
+        } else if (record.direction == Traffic_record::INCOMING) {
+            if (not sock.is_valid()) {
+                jerr << "Error: Invalid recording, a message is sent to an agent before it "
+                     << "connected.\n";
+                return 3;
+            }
+
+            if (options.replay_speed > 0.0) {
+                double delay = ((double)record.time - (double)anchor_record) / 1e6;
+                double wait = anchor_time + delay / options.replay_speed - elapsed_time();
+                if (wait > 0.0) {
+                    std::this_thread::sleep_for(std::chrono::duration<double>(wait));
+                }
+            }
+            sock.send({text, (int)record.size});
+            ++sent;
+        } else {
+            jerr << "Error: Invalid record in recording, direction " << (int)record.direction << '\n';
+            return 3;
+        }
+    }
+
+    jout << "Replayed the recording to " << connected << " agents in " << elapsed_time() - time_begin
+         << "s, sent " << sent << " and received " << received << " messages." << endl;
+    return 0;
+}
+
+} /* end of namespace jup */
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "buffer.hpp"
+
+namespace jup {
+
+class Server;
+struct Server_options;
+
+/**
+ * Writes the inputs of Mothership_team::on_request_action into a file, so that the search can
+ * be rerun without a server. The file is a sequence of records, each consisting of a u32 type, a
+ * u32 size and then size bytes of data. A MAP record contains the name of the graph and is
+ * followed by a TEAM record, containing the team size the planner was instantiated for as a u32,
+ * and any number of steps. Each step consists of a STRINGS, WORLD, SIT and SIT_OLD record, in that
+ * order. These contain the string ids (see save_string_ids) and the respective buffers of the
+ * mothership, verbatim. Captures without a TEAM record are for number_of_agents.
+ */
+struct Capture_writer {
+    enum Type: u32 {
+        MAP = 1, STRINGS, WORLD, SIT, SIT_OLD, TEAM
+    };
+
+    void open(Buffer_view path);
+    void write(u32 type, Buffer_view data);
+    void write_step(Buffer const& world, Buffer const& sit, Buffer const& sit_old);
+
+    explicit operator bool() const { return out.is_open(); }
+
+    std::ofstream out;
+    Buffer scratch;
+};
+
+/**
+ * Load the capture file given in the options and run the search of Mothership_team on each of
+ * its steps, for a fixed number of iterations. Prints the time taken by the phases of the search
+ * and the rating of the best strategy. Returns the exit code.
+ */
+int replay_main(Server* server, Server_options const& options);
+
+/**
+ * Parse the incoming messages of the xml dump given in the options (see the -d option) with both
+ * pugixml and Xml_parser. Checks that the resulting messages are the same and prints the
+ * throughput of each. Returns the exit code.
+ */
+int parse_bench_main(Server* server, Server_options const& options);
+
+/**
+ * Measure the round-trip time of a loopback connection: an action is sent and answered with a
+ * message of the size of a percept, once with and once without TCP_NODELAY, using the socket
+ * options given otherwise. Then measure the time to send an action over each of the connections of
+ * a team, one after the other and with Socket_sender. Prints the distribution of the times.
+ * Returns the exit code.
+ */
+int socket_bench_main(Server_options const& options);
+
+/**
+ * Play the recording given in the options (see record_traffic) back to the agents connecting on
+ * localhost, as a replacement for MASSim. The recorded messages of the server are sent in order,
+ * and for each recorded message of an agent the next message on its connection is awaited, but not
+ * checked. Messages are delayed as recorded, relative to the last message of an agent and divided
+ * by the speed in the options. Returns the exit code.
+ */
+int serve_main(Server_options const& options);
+
+} /* end of namespace jup */
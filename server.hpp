@@ -4,6 +4,7 @@
 #include "system.hpp"
 #include "objects.hpp"
 #include "graph.hpp"
+#include "messages.hpp"
                     
 namespace jup {
 
@@ -20,18 +21,34 @@ constexpr auto LOAD_CFGFILE = "--load";
 constexpr auto LAMPE_SHIP = "-s";
 constexpr auto MASSIM_QUIET = "-q";
 constexpr auto STATS_FILE = "--stats";
+constexpr auto CAPTURE_FILE = "--capture";
+constexpr auto REPLAY_ITERATIONS = "--iterations";
+constexpr auto SEARCH_MODE = "--search";
+constexpr auto PARSE_THREADS = "--parse-threads";
+constexpr auto SOCKET_BUFFER = "--socket-buffer";
+constexpr auto RECORD_FILE = "--record";
+constexpr auto REPLAY_SPEED = "--speed";
 
 constexpr auto LAMPE_SHIP_TEST = "test";
 constexpr auto LAMPE_SHIP_TEST2 = "test2";
 constexpr auto LAMPE_SHIP_STATS = "stats";
 constexpr auto LAMPE_SHIP_PLAY = "play";
 constexpr auto LAMPE_SHIP_DUMMY = "dummy";
+constexpr auto LAMPE_SHIP_REPLAY = "replay";
+constexpr auto LAMPE_SHIP_PARSE = "parse";
+constexpr auto LAMPE_SHIP_SOCKETS = "sockets";
+constexpr auto LAMPE_SHIP_SERVE = "serve";
+constexpr auto SEARCH_MODE_FLAT = "flat";
+constexpr auto SEARCH_MODE_TREE = "tree";
     
 }
 
 struct Server_options {
     enum Ship: u8 {
-        SHIP_TEST, SHIP_TEST2, SHIP_STATS, SHIP_PLAY, SHIP_DUMMY
+        SHIP_TEST, SHIP_TEST2, SHIP_STATS, SHIP_PLAY, SHIP_DUMMY, SHIP_REPLAY, SHIP_PARSE, SHIP_SOCKETS, SHIP_SERVE
+    };
+    enum Search_mode: u8 {
+        SEARCH_FLAT, SEARCH_TREE
     };
     struct Agent_option {
         Buffer_view name, password;
@@ -47,6 +64,13 @@ struct Server_options {
     Buffer_view dump_xml;
     u8 ship = SHIP_TEST;
 	Buffer_view statistics_file;
+    Buffer_view capture_file;
+    int replay_iterations = 200;
+    u8 search_mode = SEARCH_FLAT;
+    int parse_threads = 0;
+    Socket_options socket_options;
+    Buffer_view record_file;
+    double replay_speed = 1.0;
     Buffer _string_storage;
     bool massim_quiet = false;
 
@@ -60,6 +84,8 @@ struct Mothership {
     virtual void pre_request_action(u8 agent, Percept const& perc, int perc_size) = 0;
     virtual void on_request_action() = 0;
     virtual void post_request_action(u8 agent, Buffer* into) = 0;
+    // Called after the actions of all agents have been sent
+    virtual void on_actions_sent() {}
     virtual ~Mothership() {};
 };
 
@@ -73,6 +99,26 @@ class Server {
         u8 id;
         bool is_dumb;
         u16 last_perception_id;
+        // The Message_Request_Action of this step in the step_buffer, see receive_percepts
+        int percept_offset;
+        int percept_end;
+    };
+
+    // The time spent in receive_percepts during the current simulation, in seconds. wait is the
+    // time until the first data arrived, ingest the time from then until all percepts were parsed.
+    struct Ingestion_stats {
+        double wait = 0.0;
+        double ingest = 0.0;
+        double ingest_max = 0.0;
+        int steps = 0;
+    };
+
+    // The time spent sending the actions during the current simulation, in seconds, from handing
+    // the first one of a step to the system until the last one was handed over.
+    struct Sending_stats {
+        double send = 0.0;
+        double send_max = 0.0;
+        int steps = 0;
     };
     
 public:
@@ -83,6 +129,8 @@ public:
     ~Server();
 
     bool load_maps();
+    // Return the loaded graph with that name, or nullptr if there is none
+    Graph* find_graph(Buffer_view name);
 
     void register_mothership(Mothership* mothership);
     bool register_agent(Server_options::Agent_option const& agent);
@@ -102,12 +150,21 @@ public:
     }
 
 private:
+    void receive_percepts(int& step);
+
     Buffer agent_buffer;
     Buffer general_buffer;
 	Buffer step_buffer;
     int mothership_offset;
     Mothership* mothership = nullptr;
     std::vector<Graph> graphs;
+    Ingestion_stats ingestion;
+    Parse_pool parse_pool;
+    Array<Socket*> waiting_sockets;
+    Array<bool> readable;
+    Socket_sender sender;
+    Array<Socket*> sending_sockets;
+    Sending_stats sending;
 
     std::thread stdin_listener;
 };
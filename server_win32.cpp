@@ -46,7 +46,37 @@ bool find_file_not_containing(
 
 bool Server_options::check_valid() {
     using namespace cmd_options;
-    if (use_internal_server) {
+    if (ship == SHIP_REPLAY) {
+        if (not capture_file) {
+            jerr << "Mode replay was requested, but no capture file was specified. You may want to"
+                " use the " << CAPTURE_FILE << " option.\n";
+            return false;
+        }
+        if (not massim_loc) {
+            jerr << "Mode replay needs the location of massim to load the maps. You may want to use"
+                " the " << MASSIM_LOC << " option.\n";
+            return false;
+        }
+    } else if (ship == SHIP_PARSE) {
+        if (not dump_xml) {
+            jerr << "Mode parse was requested, but no xml dump was specified. You may want to use"
+                " the " << DUMP_XML << " option.\n";
+            return false;
+        }
+        if (not massim_loc) {
+            jerr << "Mode parse needs the location of massim to load the maps. You may want to use"
+                " the " << MASSIM_LOC << " option.\n";
+            return false;
+        }
+    } else if (ship == SHIP_SOCKETS) {
+        // Only uses the loopback interface
+    } else if (ship == SHIP_SERVE) {
+        if (not record_file) {
+            jerr << "Mode serve was requested, but no recording was specified. You may want to use"
+                " the " << RECORD_FILE << " option.\n";
+            return false;
+        }
+    } else if (use_internal_server) {
         if (not massim_loc) {
             jerr << "The internal server is used, but the location of massim is not specified."
                 " You may want to use the " << MASSIM_LOC << " option.\n";
@@ -94,14 +124,19 @@ void sigint_from_stdin() {
 Server::Server(Server_options const& op): options{op} {
     using namespace cmd_options;
 
-    if (options.use_internal_server) {
+    if (options.ship == Server_options::SHIP_REPLAY) {
+        jout << "Replaying a capture, no server is used.\n";
+    } else if (options.ship == Server_options::SHIP_PARSE) {
+        jout << "Parsing an xml dump, no server is used.\n";
+    } else if (options.use_internal_server) {
         jout << "Running internal server...\n";
     } else {
         jout << "Connecting to external server, IP: " << options.host_ip.c_str() << ", Port: "
              << options.host_port.c_str() << "\n";
     }
             
-    if (op.use_internal_server) {
+    bool offline = op.ship == Server_options::SHIP_REPLAY or op.ship == Server_options::SHIP_PARSE;
+    if (op.use_internal_server and not offline) {
         if (!is_debugged()) {
             stdin_listener = std::thread {&sigint_from_stdin};
         }
@@ -268,6 +303,12 @@ bool Server::load_maps() {
     return true;
 }
 
+Graph* Server::find_graph(Buffer_view name) {
+    for (Graph& graph: graphs) {
+        if (name == graph.name()) return &graph;
+    }
+    return nullptr;
+}
 
 void Server::register_mothership(Mothership* mothership_) {
     mothership = mothership_;
@@ -285,15 +326,15 @@ bool Server::register_agent(Server_options::Agent_option const& agent) {
     data.is_dumb = agent.is_dumb;
     if (options.use_internal_server) {
         if (options.host_port) {
-            data.socket.init("localhost", options.host_port);
+            data.socket.init("localhost", options.host_port, options.socket_options);
         } else {
-            data.socket.init("localhost", "12300");
+            data.socket.init("localhost", "12300", options.socket_options);
         }
     } else {
         if (options.host_port) {
-            data.socket.init(options.host_ip, options.host_port);
+            data.socket.init(options.host_ip, options.host_port, options.socket_options);
         } else {
-            data.socket.init(options.host_ip, "12300");
+            data.socket.init(options.host_ip, "12300", options.socket_options);
         }
     }
     
@@ -315,6 +356,121 @@ bool Server::register_agent(Server_options::Agent_option const& agent) {
     return true;
 }
 
+/**
+ * Read the Message_Request_Action of every agent into the step_buffer and set percept_offset and
+ * percept_end. Instead of reading the sockets in order, this waits on all of them at once and
+ * parses each percept as soon as it is complete, so that a slow agent does not delay the others.
+ */
+void Server::receive_percepts(int& step) {
+    double time_begin = elapsed_time();
+    double time_first = -1.0;
+
+    int remaining = agents().size();
+    for (Agent_data& i: agents()) {
+        i.percept_offset = -1;
+    }
+
+    while (true) {
+        for (Agent_data& i: agents()) {
+            if (parse_pool and i.percept_offset == -1) {
+                // Parsed in the background, the step is checked after finish
+                char* text;
+                int size;
+                if (take_message_text(i.socket, &text, &size)) {
+                    parse_pool.submit(i.id, text);
+                    i.percept_offset = -2;
+                    --remaining;
+                }
+                continue;
+            }
+            while (i.percept_offset == -1 and message_buffered(i.socket)) {
+                int offset = step_buffer.size();
+                auto& mess = get_next_message_ref<Message_Request_Action>(i.socket, &step_buffer);
+                if (options.use_internal_server) {
+                    assert(mess.perception.simulation_step == step);
+                } else if (step < mess.perception.simulation_step) {
+                    jerr << "Warning: Adjusting simulation step from " << step << " to "
+                         << mess.perception.simulation_step << '\n';
+                    step = mess.perception.simulation_step + 1;
+                } else if (step > mess.perception.simulation_step) {
+                    // An old percept, wait for the next one
+                    jerr << "Warning: Agent " << i.name.c_str() << " (socket " << i.socket.get_id()
+                         << ") received a percept of step " << mess.perception.simulation_step
+                         << " while in step " << step << ", skipping it\n";
+                    continue;
+                }
+                i.percept_offset = offset;
+                i.percept_end = step_buffer.size();
+                --remaining;
+            }
+        }
+        if (remaining == 0) break;
+
+        waiting_sockets.reset();
+        for (Agent_data& i: agents()) {
+            if (i.percept_offset != -1) continue;
+            waiting_sockets.push_back(&i.socket);
+        }
+        readable.resize(waiting_sockets.size());
+
+        int count = wait_readable(waiting_sockets.data(), waiting_sockets.size(), readable.data());
+        if (count == -1) {
+            // wait_readable already printed the reason
+            jerr << "Error: Could not wait for the percepts of " << waiting_sockets.size()
+                 << " agents in step " << step << ", exiting.\n";
+            die(false);
+            return;
+        }
+        if (time_first < 0.0) {
+            time_first = elapsed_time();
+        }
+        for (int j = 0; j < waiting_sockets.size(); ++j) {
+            if (readable[j]) {
+                receive_available(*waiting_sockets[j]);
+            }
+        }
+    }
+
+    if (parse_pool) {
+        parse_pool.finish(&step_buffer);
+        for (Agent_data& i: agents()) {
+            auto const& job = parse_pool.jobs[i.id];
+            assert(job.type == Message::REQUEST_ACTION);
+            i.percept_offset = job.offset;
+            i.percept_end = job.end;
+
+            auto* mess = &step_buffer.get<Message_Request_Action>(i.percept_offset);
+            if (options.use_internal_server) {
+                assert(mess->perception.simulation_step == step);
+            } else if (step < mess->perception.simulation_step) {
+                jerr << "Warning: Adjusting simulation step from " << step << " to "
+                     << mess->perception.simulation_step << '\n';
+                step = mess->perception.simulation_step + 1;
+            } else {
+                // Old percepts are rare, read the next ones in order
+                while (step > mess->perception.simulation_step) {
+                    jerr << "Warning: Agent " << i.name.c_str() << " (socket " << i.socket.get_id()
+                         << ") received a percept of step " << mess->perception.simulation_step
+                         << " while in step " << step << ", reading the next one\n";
+                    i.percept_offset = step_buffer.size();
+                    mess = &get_next_message_ref<Message_Request_Action>(i.socket, &step_buffer);
+                    i.percept_end = step_buffer.size();
+                }
+            }
+        }
+    }
+
+    double time_end = elapsed_time();
+    if (time_first < 0.0) {
+        // Everything was buffered already
+        time_first = time_begin;
+    }
+    ingestion.wait += time_first - time_begin;
+    ingestion.ingest += time_end - time_first;
+    ingestion.ingest_max = std::max(ingestion.ingest_max, time_end - time_first);
+    ++ingestion.steps;
+}
+
 void Server::run_simulation() {
     if (options.agents.size()) {
         // Make sure to have all the dumb agents at the end
@@ -338,6 +494,13 @@ void Server::run_simulation() {
         assert(false);
     }
 
+    if (options.parse_threads and not parse_pool) {
+        parse_pool.init(options.parse_threads, agents().size());
+    }
+    if (not sender) {
+        sender.init(agents().size());
+    }
+
     // Press ENTER to start the simulation
     if (options.use_internal_server) {
         proc.write_to_buffer = false;
@@ -366,16 +529,10 @@ void Server::run_simulation() {
             // Initialize the map
             if (i == 0) {            
                 Buffer_view name = get_string_from_id(mess.simulation.map);
-                bool found = false;
-                for (Graph& graph: graphs) {
-                    if (name == graph.name()) {
-                        set_messages_graph(&graph);
-						mothership->init(&graph);
-                        found = true;
-                        break;
-                    }
-                }
-                if (not found) {
+                if (Graph* graph = find_graph(name)) {
+                    set_messages_graph(graph);
+                    mothership->init(graph);
+                } else {
                     jerr << "Error: Could not find map " << name.c_str() << '\n';
                     die(false);
                     return;
@@ -409,32 +566,20 @@ void Server::run_simulation() {
         
             step_buffer.reset();
             mothership->pre_request_action();
-        
-            for (Agent_data& i: agents()) {
-                auto mess = &get_next_message_ref<Message_Request_Action>(i.socket, &step_buffer);
-                if (options.use_internal_server) {
-                    assert(mess->perception.simulation_step == step);
-                } else {
-                    if (step < mess->perception.simulation_step) {
-                        jerr << "Warning: Adjusting simulation step from " << step << " to "
-                             << mess->perception.simulation_step << '\n';
-                        step = mess->perception.simulation_step + 1;
-                    } else if (step > mess->perception.simulation_step) {
-                        while (step > mess->perception.simulation_step) {
-                            jerr << "Warning: aksjdkajsd\n";
-                            mess = &get_next_message_ref<Message_Request_Action>(i.socket, &step_buffer);
-                        }
-                    }
-                }
+            receive_percepts(step);
 
-                i.last_perception_id = mess->perception.id;
+            for (Agent_data& i: agents()) {
+                auto& mess = step_buffer.get<Message_Request_Action>(i.percept_offset);
+                i.last_perception_id = mess.perception.id;
                 if (not i.is_dumb) {
-                    mothership->pre_request_action(i.id, mess->perception,
-                                                   step_buffer.end() - (char*)&mess->perception);
+                    mothership->pre_request_action(i.id, mess.perception,
+                        step_buffer.data() + i.percept_end - (char*)&mess.perception);
                 }
             }
             mothership->on_request_action();
-        
+
+            // Write all actions first, then send them together
+            sending_sockets.reset();
             for (Agent_data& i: agents()) {
                 int action_offset = step_buffer.size();
             
@@ -451,8 +596,21 @@ void Server::run_simulation() {
                 auto& answ = step_buffer.emplace_back<Message_Action>(
                     i.last_perception_id, step_buffer.get<Action_Post_job>(action_offset), &step_buffer
                 );
-                send_message(i.socket, answ);
+                prepare_message(i.socket, answ);
+                sending_sockets.push_back(&i.socket);
             }
+
+            // This file links against sockets_win32.cpp, where send_buffers sends one action after
+            // the other. Only sockets_posix.cpp submits them as one batch, and the server does not
+            // build on Linux yet, so that is only measured by -s sockets.
+            double time_send = elapsed_time();
+            sender.send_buffers(sending_sockets.data(), sending_sockets.size());
+            double time_sent = elapsed_time() - time_send;
+            sending.send += time_sent;
+            sending.send_max = std::max(sending.send_max, time_sent);
+            ++sending.steps;
+            flush_traffic_recording();
+            mothership->on_actions_sent();
         }
         
         if (options.use_internal_server) {
@@ -465,6 +623,31 @@ void Server::run_simulation() {
             jout << "The match has ended. Agent " << i.name.c_str() << " has a ranking of "
                  << (int)mess.ranking << " and a score of " << mess.score << '\n';
         }
+        flush_traffic_recording();
+        if (ingestion.steps) {
+            jout << "Percepts: waited " << ingestion.wait / ingestion.steps * 1000.0
+                 << "ms per step for the server, then received and parsed them in "
+                 << ingestion.ingest / ingestion.steps * 1000.0 << "ms on average, "
+                 << ingestion.ingest_max * 1000.0 << "ms at most\n";
+
+            auto shared = get_shared_section_stats(true);
+            if (shared.parsed) {
+                double saved = shared.reused * shared.parse_time / shared.parsed
+                    - shared.overhead_time;
+                jout << "Shared sections: parsed " << (double)shared.parsed / ingestion.steps
+                     << " and reused " << (double)shared.reused / ingestion.steps
+                     << " times per step, copying " << nice_bytes(shared.bytes_reused / ingestion.steps)
+                     << " per step instead of parsing saved about " << saved / ingestion.steps * 1000.0
+                     << "ms\n";
+            }
+        }
+        ingestion = Ingestion_stats {};
+        if (sending.steps) {
+            jout << "Actions: send_buffers took " << sending.send / sending.steps * 1e6
+                 << "us per step on average and " << sending.send_max * 1e6 << "us at most, sending "
+                 << (sender.batched ? "in one batch" : "one after the other") << '\n';
+        }
+        sending = Sending_stats {};
 
         if (options.use_internal_server) break;
     }
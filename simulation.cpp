@@ -32,6 +32,45 @@ World::World(Simulation const& s0, Graph* graph, Buffer* containing):
     SIZE_SUBARR(s0, containing, items, tools);
     
     size += roles.extra_space(number_of_agents);
+
+    // Compile the recipes. First determine the depth of each item, which gives an order where
+    // parts come before the items assembled from them.
+    int n = s0.items.size();
+    u8 index[256];
+    std::memset(index, 0xff, sizeof(index));
+    for (int i = 0; i < n; ++i) {
+        index[s0.items[i].id] = i;
+    }
+    
+    u8 depth[256];
+    std::memset(depth, 0xff, sizeof(depth));
+    for (int done = 0, it = 0; done < n; ++it) {
+        assert(it < n /* the recipes contain a cycle */);
+        for (int i = 0; i < n; ++i) {
+            if (depth[i] != 0xff) continue;
+            u8 d = 0;
+            bool ready = true;
+            for (Item_stack j: s0.items[i].consumed) {
+                assert(index[j.id] != 0xff);
+                u8 d_j = depth[index[j.id]];
+                if (d_j == 0xff) {
+                    ready = false;
+                    break;
+                }
+                d = std::max(d, (u8)(d_j + 1));
+            }
+            if (not ready) continue;
+            depth[i] = d;
+            ++done;
+        }
+    }
+
+    u8 order[256];
+    for (int i = 0; i < n; ++i) order[i] = i;
+    std::stable_sort(order, order + n, [&depth](u8 a, u8 b) { return depth[a] < depth[b]; });
+
+    size += recipes.extra_space(n);
+    
     auto guard = containing->reserve_guard(size);
     auto this_ = &containing->get<World>(this_offset);
 
@@ -40,6 +79,20 @@ World::World(Simulation const& s0, Graph* graph, Buffer* containing):
     COPY_SUBARR(s0, containing, items, tools);
 
     this_->roles.init(number_of_agents, containing);
+
+    std::memset(this_->item_index, 0xff, sizeof(item_index));
+    std::memset(this_->item_cost_index, 0xff, sizeof(item_cost_index));
+    std::memset(this_->recipe_index, 0xff, sizeof(recipe_index));
+    for (int i = 0; i < this_->items.size(); ++i) {
+        this_->item_index[this_->items[i].id] = i;
+    }
+
+    this_->recipes.init(containing);
+    for (int k = 0; k < n; ++k) {
+        Item const& item = this_->items[order[k]];
+        this_->recipes.push_back(Recipe {item.id, depth[order[k]]}, containing);
+        this_->recipe_index[item.id] = k;
+    }
 }
 
 void World::update(Simulation const& s, u8 id, Buffer* containing) {
@@ -50,6 +103,13 @@ void World::update(Simulation const& s, u8 id, Buffer* containing) {
     roles[id].speed = s.role.speed;
     roles[id].battery = s.role.battery;
     roles[id].load = s.role.load;
+    for (int tool = 0; tool < 256; ++tool) {
+        tool_agents[tool] &= ~(1u << id);
+    }
+    for (u8 tool: s.role.tools) {
+        tool_agents[tool] |= 1u << id;
+    }
+    
     // This may invalidate us, but that is okay
     roles[id].tools.init(s.role.tools, containing);
 }
@@ -84,43 +144,31 @@ void World::step_init(Percept const& p0, Buffer* containing) {
     // TODO: add else branch for recovery
 
     auto infer_assembled_item_cost = [this_]() {
-        for (int i = 0; i < this_->item_costs.size(); ++i) {
-            if (this_->items[i].consumed.size() == 0) continue;
-            auto& item = this_->item_costs[i];
-            item.sum = 0;
-            item.count = 0;
-        }
-                
-        int it;
-        for (it = 0; it < this_->item_costs.size(); ++it) {
-            bool dirty = false;
-            for (int i = 0; i < this_->item_costs.size(); ++i) {
-                auto& item = this_->item_costs[i];
-                if (item.count) continue;
-
-                dirty = true;
-                
-                u16 cost = price_craft_val;
-                u8 craftval = 1;
-                bool flag = false;
-                for (auto const& j: this_->items[i].consumed) {
-                    auto& j_item = get_by_id(this_->item_costs, j.id);
-                    if (j_item.count == 0) {
-                        flag = true;
-                        break;
-                    }
-                    cost += j_item.value() * j.amount;
-                    craftval += j_item.craftval * j.amount;
+        // The recipes are ordered, so the parts always have their value already
+        for (auto const& r: this_->recipes) {
+            auto& item = this_->item_costs[this_->item_cost_index[r.id]];
+            if (r.depth == 0) {
+                // A base item no shop sells has to be gathered, that is valued like an assembly
+                if (item.count == 0) {
+                    item.sum = price_craft_val;
+                    item.count = 1;
+                    item.craftval = 1;
                 }
-                if (flag) continue;
-        
-                item.sum = cost;
-                item.craftval = craftval;
-                ++item.count;
+                continue;
             }
-            if (not dirty) break;
+            
+            u16 cost = price_craft_val;
+            u8 craftval = 1;
+            for (auto const& j: this_->item(r.id).consumed) {
+                auto& j_item = this_->item_cost(j.id);
+                assert(j_item.count);
+                cost += j_item.value() * j.amount;
+                craftval += j_item.craftval * j.amount;
+            }
+            item.sum = cost;
+            item.count = 1;
+            item.craftval = craftval;
         }
-        assert(it < this_->item_costs.size());
     };
     
     if (this_->item_costs.size() == 0) {
@@ -128,10 +176,13 @@ void World::step_init(Percept const& p0, Buffer* containing) {
         for (Item const& item: this_->items) {
             this_->item_costs.push_back({item.id, 0, 0, 0}, containing);
         }
+        for (int i = 0; i < this_->item_costs.size(); ++i) {
+            this_->item_cost_index[this_->item_costs[i].id] = i;
+        }
         
         for (auto const& shop: p0.shops) {
             for (auto const& i: shop.items) {
-                auto& j = get_by_id(this_->item_costs, i.id);
+                auto& j = this_->item_costs[this_->item_cost_index[i.id]];
                 ++j.count;
                 j.sum += (u16)(i.cost * price_shop_factor);
             }
@@ -197,7 +248,8 @@ void World::step_update(Percept const& p, u8 id, Buffer* containing) {}
 
 void World::step_post(Buffer* containing) {}
     
-Situation::Situation(Percept const& p0, Situation const* sit_old, Buffer* containing):
+template <int N>
+Situation<N>::Situation(Percept const& p0, Situation const* sit_old, Buffer* containing):
     initialized{true},
     simulation_step{p0.simulation_step},
     team_money{p0.team_money}
@@ -250,18 +302,21 @@ Situation::Situation(Percept const& p0, Situation const* sit_old, Buffer* contai
     containing->reserve_space(size);
     auto this_ = &containing->get<Situation>(this_offset);
     
+    this_->index_facilities();
+    this_->index_jobs();
+    
     this_->book.delivered.init(containing);
     if (sit_old) {
         for (auto i: sit_old->book.delivered) {
             // Ignore the ones there are no jobs for
-            if (find_by_id_job(i.job_id)) {
+            if (this_->find_by_id_job(i.job_id)) {
                 this_->book.delivered.push_back(i, containing);
             }
         }
     }
     
     if (sit_old) {
-        for (u8 agent = 0; agent < number_of_agents; ++agent) {
+        for (u8 agent = 0; agent < N; ++agent) {
             this_->self(agent).task_index = sit_old->self(agent).task_index;
             // get_action is already stateless, and task_update only uses states for communication
             this_->self(agent).task_state = 0;
@@ -280,10 +335,11 @@ Situation::Situation(Percept const& p0, Situation const* sit_old, Buffer* contai
         }
     }
 }
-void Situation::update(Percept const& p, u8 id, Buffer* containing) {
+template <int N>
+void Situation<N>::update(Percept const& p, u8 id, Buffer* containing) {
     assert(containing and containing->inside(this));
     
-    assert(0 <= id and id < number_of_agents);
+    assert(0 <= id and id < N);
     selves[id].id = p.self.id;
     selves[id].team = p.self.team;
     selves[id].pos = p.self.pos;
@@ -304,6 +360,17 @@ void Situation::update(Percept const& p, u8 id, Buffer* containing) {
 
     this_->selves[id].items.init(p.self.items, containing);
     this_->selves[id].route.init(p.self.route, containing);
+    this_->index_items(id);
+}
+
+template <int N>
+void Situation<N>::index_items(u8 agent) {
+    for (int i = 0; i < 256; ++i) {
+        item_holders[i] &= ~(1u << agent);
+    }
+    for (auto i: self(agent).items) {
+        if (i.amount > 0) update_holding(agent, i.id, i.amount);
+    }
 }
 
 #undef SIZE_ARRAY
@@ -321,13 +388,14 @@ void Bookkeeping::add_item_to_job(u16 job_id, Item_stack item, Diff_flat_arrays*
     diff->add(delivered, {job_id, item});
 }
     
-void Situation::flush_old(World const& world, Situation const& old, Diff_flat_arrays* diff) {
+template <int N>
+void Situation<N>::flush_old(World const& world, Situation const& old, Diff_flat_arrays* diff) {
     assert(diff);
     moving_on(world, old, diff);
     
     assert(&strategy.task(0, 1) - &strategy.task(0, 0) == 1);
 
-    for (u8 agent = 0; agent < number_of_agents; ++agent) {
+    for (u8 agent = 0; agent < N; ++agent) {
         if (self(agent).task_index == 0) continue;
         while (self(agent).task_index) {
             strategy.pop_task(agent, 0);
@@ -339,10 +407,11 @@ void Situation::flush_old(World const& world, Situation const& old, Diff_flat_ar
     }
 }
 
-void Situation::register_arr(Diff_flat_arrays* diff) {
+template <int N>
+void Situation<N>::register_arr(Diff_flat_arrays* diff) {
     assert(diff);
     
-    for (u8 i = 0; i < number_of_agents; ++i) {
+    for (u8 i = 0; i < N; ++i) {
         diff->register_arr(selves[i].items, "self.items");
         diff->register_arr(selves[i].route, "self.route");
     }
@@ -367,7 +436,8 @@ void Situation::register_arr(Diff_flat_arrays* diff) {
     diff->register_commit();
 }
 
-bool Situation::agent_goto(u8 where, u8 agent, Buffer* into) {
+template <int N>
+bool Situation<N>::agent_goto(u8 where, u8 agent, Buffer* into) {
     auto& d = self(agent);
 
     // Could send continue if same location as last time
@@ -382,14 +452,16 @@ bool Situation::agent_goto(u8 where, u8 agent, Buffer* into) {
     }
 }
 
-void Situation::moving_on(World const& world, Situation const& old, Diff_flat_arrays* diff) {
+template <int N>
+void Situation<N>::moving_on(World const& world, Situation const& old, Diff_flat_arrays* diff) {
     moving_on_one(world, old, diff);
 
+    Crafting_planner<N> planner;
     while (true) {
         // Check whether some assemblers are not required
-        Crafting_plan plan = combined_plan(world);
+        Crafting_plan<N> const& plan = planner.update(*this, world);
 
-        for (u8 agent = 0; agent < number_of_agents; ++agent) {
+        for (u8 agent = 0; agent < N; ++agent) {
             bool flag = false;
             if (plan.slot(agent).type == Crafting_slot::USELESS) {
                 flag = true;
@@ -399,7 +471,7 @@ void Situation::moving_on(World const& world, Situation const& old, Diff_flat_ar
             {
                 // Only need this so long as we cannot trust the ASSIST_ASSEMBLE results
                 flag = true;
-                for (u8 o_agent = 0; o_agent < number_of_agents; ++o_agent) {
+                for (u8 o_agent = 0; o_agent < N; ++o_agent) {
                     for (u8 i = 0; i < planning_max_tasks; ++i) {
                         if (strategy.task(o_agent, i).task.type == Task::CRAFT_ITEM
                             and strategy.task(o_agent, i).task.craft_id == task(agent).task.craft_id)
@@ -422,10 +494,11 @@ void Situation::moving_on(World const& world, Situation const& old, Diff_flat_ar
     }
 }
     
-bool Situation::moving_on_one(World const& world, Situation const& old, Diff_flat_arrays* diff) {
+template <int N>
+bool Situation<N>::moving_on_one(World const& world, Situation const& old, Diff_flat_arrays* diff) {
     bool dirty = false;
     
-    for (u8 agent = 0; agent < number_of_agents; ++agent) {
+    for (u8 agent = 0; agent < N; ++agent) {
         auto& d = self(agent);
         while (d.task_index < planning_max_tasks) {
             auto& t = task(agent);
@@ -531,7 +604,8 @@ bool Situation::moving_on_one(World const& world, Situation const& old, Diff_fla
     return dirty;
 }
 
-void Situation::idle_task(World const& world, Situation const& old, u8 agent,
+template <int N>
+void Situation<N>::idle_task(World const& world, Situation const& old, u8 agent,
     Array<Auction_bet>* bets, Buffer* into)
 {
     if (bets->size()) {
@@ -543,7 +617,8 @@ void Situation::idle_task(World const& world, Situation const& old, u8 agent,
     }
 }
 
-void Situation::get_action(World const& world, Situation const& old, u8 agent,
+template <int N>
+void Situation<N>::get_action(World const& world, Situation const& old, u8 agent,
     Crafting_slot const& cs, Array<Auction_bet>* bets, Buffer* into)
 {
     assert(bets);
@@ -611,26 +686,81 @@ void Situation::get_action(World const& world, Situation const& old, u8 agent,
     return;
 }
 
-Pos Situation::find_pos(u8 id) const {
-    for (auto const& i: charging_stations) {
-        if (i.id == id) return i.pos;
-    }
-    for (auto const& i: dumps) {
-        if (i.id == id) return i.pos;
-    }
-    for (auto const& i: shops) {
-        if (i.id == id) return i.pos;
-    }
-    for (auto const& i: storages) {
-        if (i.id == id) return i.pos;
-    }
-    for (auto const& i: workshops) {
-        if (i.id == id) return i.pos;
+template <int N>
+void Situation<N>::index_facilities() {
+    std::memset(facility_index, 0xff, sizeof(facility_index));
+    std::memset(facility_type,  0xff, sizeof(facility_type));
+    auto add = [this](auto const& arr, u8 type) {
+        for (int i = 0; i < arr.size(); ++i) {
+            facility_index[arr[i].id] = i;
+            facility_type [arr[i].id] = type;
+        }
+    };
+    add(charging_stations, CHARGING_STATION);
+    add(dumps,             DUMP);
+    add(shops,             SHOP);
+    add(storages,          STORAGE);
+    add(workshops,         WORKSHOP);
+}
+
+template <int N>
+void Situation<N>::index_jobs() {
+    std::memset(job_index, 0xff, sizeof(job_index));
+    std::memset(job_type,  0xff, sizeof(job_type));
+    
+    job_id_base = 0xffff;
+    for (auto const& i: jobs)     job_id_base = std::min(job_id_base, i.id);
+    for (auto const& i: auctions) job_id_base = std::min(job_id_base, i.id);
+    for (auto const& i: missions) job_id_base = std::min(job_id_base, i.id);
+    for (auto const& i: posteds)  job_id_base = std::min(job_id_base, i.id);
+    
+    auto add = [this](auto const& arr, u8 type) {
+        for (int i = 0; i < arr.size() and i < 0xff; ++i) {
+            int off = arr[i].id - job_id_base;
+            if (off >= 256) continue;
+            job_index[off] = i;
+            job_type [off] = type;
+        }
+    };
+    add(jobs,     Job::JOB);
+    add(auctions, Job::AUCTION);
+    add(missions, Job::MISSION);
+    add(posteds,  Job::POSTED);
+    job_count_indexed = jobs.size() + auctions.size() + missions.size() + posteds.size();
+}
+
+template <int N>
+Pos Situation<N>::find_pos(u8 id) const {
+    u8 index = facility_index[id];
+    switch (facility_type[id]) {
+    case CHARGING_STATION: return charging_stations[index].pos;
+    case DUMP:             return dumps            [index].pos;
+    case SHOP:             return shops            [index].pos;
+    case STORAGE:          return storages         [index].pos;
+    case WORKSHOP:         return workshops        [index].pos;
+    default: assert(false);
     }
-    assert(false);
 }
 
-Job* Situation::find_by_id_job(u16 id, u8* type) {
+template <int N>
+Job* Situation<N>::find_by_id_job(u16 id, u8* type) {
+    assert(job_count_indexed == jobs.size() + auctions.size() + missions.size() + posteds.size());
+    
+    int off = id - job_id_base;
+    if (0 <= off and off < 256) {
+        u8 index = job_index[off];
+        u8 t = job_type[off];
+        if (type) *type = index == 0xff ? Job::NONE : t;
+        switch (index == 0xff ? Job::NONE : t) {
+        case Job::JOB:     return &jobs    [index];
+        case Job::AUCTION: return &auctions[index];
+        case Job::MISSION: return &missions[index];
+        case Job::POSTED:  return &posteds [index];
+        default:           return nullptr;
+        }
+    }
+    
+    // Outside of the window, this is rare
     for (auto& i: jobs) {
         if (i.id == id) {
             if (type) *type = Job::JOB;
@@ -658,24 +788,31 @@ Job* Situation::find_by_id_job(u16 id, u8* type) {
     if (type) *type = Job::NONE;
     return nullptr;
 }
-Job& Situation::get_by_id_job(u16 id, u8* type) {
+template <int N>
+Job& Situation<N>::get_by_id_job(u16 id, u8* type) {
     Job* result = find_by_id_job(id, type);
     assert(result);
     return *result;
 }
 
-void Situation::add_item_to_agent(u8 agent, Item_stack item, Diff_flat_arrays* diff) {
+template <int N>
+void Situation<N>::add_item_to_agent(u8 agent, Item_stack item, Diff_flat_arrays* diff) {
+    // Both paths may produce duplicate entries, fast_forward merges them
+    items_dirty |= 1u << agent;
     for (auto& i: self(agent).items) {
         if (i.id == item.id or i.amount == 0) {
             i.id = item.id;
             i.amount += item.amount;
+            update_holding(agent, i.id, i.amount);
             return;
         }
     }
     diff->add(self(agent).items, item);
+    update_holding(agent, item.id, item.amount);
 }
 
-u16 Situation::agent_dist(World const& world, Dist_cache* dist_cache, u8 agent, u8 target_id) {
+template <int N>
+u16 Situation<N>::agent_dist(World const& world, Dist_cache* dist_cache, u8 agent, u8 target_id) {
     auto& d = self(agent);
     if (world.roles[agent].speed == 5) {
         Pos target = find_pos(target_id);
@@ -694,7 +831,8 @@ u16 Situation::agent_dist(World const& world, Dist_cache* dist_cache, u8 agent,
     }
 }
 
-void Situation::agent_goto_nl(World const& world, Dist_cache* dist_cache, u8 agent, u8 target_id) {
+template <int N>
+void Situation<N>::agent_goto_nl(World const& world, Dist_cache* dist_cache, u8 agent, u8 target_id) {
     auto& d = self(agent);
     if (d.facility == target_id) return;
     
@@ -720,12 +858,13 @@ void Situation::agent_goto_nl(World const& world, Dist_cache* dist_cache, u8 age
     }
 }
 
+template <int N>
 static Array_view<u8> agent_first(u8 agent) {
-    static u8 result[number_of_agents];
+    static u8 result[N];
     result[0] = agent;
-    for (u8 i = 0; i < number_of_agents - 1; ++i)
+    for (u8 i = 0; i < N - 1; ++i)
         result[i+1] = i + (i >= agent);
-    return {result, number_of_agents};
+    return {result, N};
 }
 static u8 diff_min(Task const& task, u8 item_id) {
     // Returns an upper bound of the difference in item_id
@@ -750,15 +889,16 @@ static u8 diff_min(Task const& task, u8 item_id) {
     }
 }
 
-bool Situation::is_possible_item(World const& world, u8 agent, Task_slot& t, Item_stack i,
-    bool is_tool, bool at_all, Crafting_plan* plan)
+template <int N>
+bool Situation<N>::is_possible_item(World const& world, u8 agent, Task_slot& t, Item_stack i,
+    bool is_tool, bool at_all, Crafting_plan<N>* plan)
 {
     int count = is_tool ? 1 : i.amount * t.task.item.amount;
 
-    for (u8 o_agent: agent_first(agent)) {
+    for (u8 o_agent: agent_first<N>(agent)) {
         auto const& o_d = self(o_agent);
         if (o_d.task_index >= planning_max_tasks) continue;
-        if (is_tool and not world.roles[o_agent].tools.count(i.id)) continue;
+        if (is_tool and not world.can_use_tool(o_agent, i.id)) continue;
         
         auto const& o_t = strategy.task(o_agent, o_d.task_index);
         bool involved = (
@@ -770,8 +910,8 @@ bool Situation::is_possible_item(World const& world, u8 agent, Task_slot& t, Ite
             )
         );
         int have = 0;
-        if (auto j = find_by_id(o_d.items, i.id)) {
-            have = j->amount;
+        if (holds(o_agent, i.id)) {
+            if (auto j = find_by_id(o_d.items, i.id)) have = j->amount;
         }
 
         if (plan) {
@@ -823,18 +963,19 @@ bool Situation::is_possible_item(World const& world, u8 agent, Task_slot& t, Ite
     return true;
 }
 
-Crafting_plan Situation::crafting_orchestrator(World const& world, u8 agent) {
+template <int N>
+Crafting_plan<N> Situation<N>::crafting_orchestrator(World const& world, u8 agent) {
     auto& t = task(agent);
     assert(t.task.type == Task::CRAFT_ITEM);
 
-    Crafting_plan plan = {};
+    Crafting_plan<N> plan = {};
 
     if (t.task.where != self(agent).facility) return plan;
     plan.slot(agent).type = Crafting_slot::IDLE;
     
     // Check whether the agent can craft the item _right now_
     auto is_possible_right_now = [&]() -> bool {
-        Item const& item = get_by_id(world.items, t.task.item.id);
+        Item const& item = world.item(t.task.item.id);
 
         // Evaluate all of the, because the states in plan need to be updated.
         bool possible = true;
@@ -849,21 +990,21 @@ Crafting_plan Situation::crafting_orchestrator(World const& world, u8 agent) {
     };
 
     if (is_possible_right_now()) {
-        for (u8 o_agent = 0; o_agent < number_of_agents; ++o_agent) {
+        for (u8 o_agent = 0; o_agent < N; ++o_agent) {
             if (plan.slot(o_agent).type == Crafting_slot::UNINVOLVED) continue;
             plan.slot(o_agent).type = Crafting_slot::EXECUTE;
             plan.slot(o_agent).agent = agent;
         }
     } else {
         // Try to give the items to someone else
-        for (u8 o_agent = number_of_agents - 1; o_agent < number_of_agents; --o_agent) {
+        for (u8 o_agent = N - 1; o_agent < N; --o_agent) {
             if (plan.slot(o_agent).type != Crafting_slot::GIVE) continue;
 
-            auto const& w_item = get_by_id(world.items, plan.slot(o_agent).item.id);
+            auto const& w_item = world.item(plan.slot(o_agent).item.id);
             int load = w_item.volume * plan.slot(o_agent).item.amount;
 
             u8 found_agent = 0xff;
-            for (u8 q_agent = number_of_agents - 1; q_agent < number_of_agents; --q_agent) {
+            for (u8 q_agent = N - 1; q_agent < N; --q_agent) {
                 if (plan.slot(q_agent).type != Crafting_slot::IDLE
                     and plan.slot(q_agent).type != Crafting_slot::RECEIVE) continue;
                 //and not (plan.slot(o_agent).type == Crafting_slot::GIVE and q_agent > o_agent)*/
@@ -888,12 +1029,13 @@ Crafting_plan Situation::crafting_orchestrator(World const& world, u8 agent) {
 }
 
 
-Crafting_plan Situation::combined_plan(World const& world) {
-    Crafting_plan result = Crafting_plan {};
-    for (u8 agent = 0; agent < number_of_agents; ++agent) {
+template <int N>
+Crafting_plan<N> Situation<N>::combined_plan(World const& world) {
+    Crafting_plan<N> result = Crafting_plan<N> {};
+    for (u8 agent = 0; agent < N; ++agent) {
         if (task(agent).task.type == Task::CRAFT_ITEM) {
             auto plan = crafting_orchestrator(world, agent);
-            for (u8 o_agent = 0; o_agent < number_of_agents; ++o_agent) {
+            for (u8 o_agent = 0; o_agent < N; ++o_agent) {
                 assert(not (result.slot(o_agent).type and plan.slot(o_agent).type));
                 if (plan.slot(o_agent).type) {
                     result.slot(o_agent) = plan.slot(o_agent);
@@ -904,7 +1046,80 @@ Crafting_plan Situation::combined_plan(World const& world) {
     return result;
 }
 
-void Situation::task_update(World const& world, Dist_cache* dist_cache, u8 agent, Diff_flat_arrays* diff) {
+template <int N>
+Crafting_plan<N> const& Crafting_planner<N>::update(Situation<N>& sit, World const& world) {
+    if (not valid) {
+        plan = Crafting_plan<N> {};
+        std::memset(slot_craft, 0, sizeof(slot_craft));
+    }
+    
+    // Collect the crafts that have to be recomputed
+    u16 dirty[2 * N];
+    int dirty_count = 0;
+    auto mark_dirty = [&dirty, &dirty_count](u16 craft) {
+        if (craft == 0) return;
+        for (int i = 0; i < dirty_count; ++i) {
+            if (dirty[i] == craft) return;
+        }
+        dirty[dirty_count++] = craft;
+    };
+    auto is_dirty = [&dirty, &dirty_count](u16 craft) {
+        for (int i = 0; i < dirty_count; ++i) {
+            if (dirty[i] == craft) return true;
+        }
+        return false;
+    };
+    
+    for (u8 agent = 0; agent < N; ++agent) {
+        auto const& d = sit.self(agent);
+        Agent_state state = {};
+        if (d.task_index < planning_max_tasks) {
+            auto const& t = sit.task(agent).task;
+            state.type = t.type;
+            state.where = t.where;
+            state.craft_id = t.craft_id;
+            state.item = t.item;
+        }
+        state.task_index = d.task_index;
+        state.task_state = d.task_state;
+        state.task_sleep = d.task_sleep;
+        state.facility = d.facility;
+        state.load = d.load;
+        for (auto i: d.items) {
+            state.items_hash = state.items_hash * 31 + (i.id << 8 | i.amount);
+        }
+
+        if (valid and state == states[agent]) continue;
+        if (valid) mark_dirty(states[agent].craft());
+        mark_dirty(state.craft());
+        states[agent] = state;
+    }
+
+    // Drop the outdated plans, then recompute them
+    for (u8 agent = 0; agent < N; ++agent) {
+        if (slot_craft[agent] and is_dirty(slot_craft[agent])) {
+            plan.slot(agent) = Crafting_slot {};
+            slot_craft[agent] = 0;
+        }
+    }
+    for (u8 agent = 0; agent < N; ++agent) {
+        if (states[agent].type != Task::CRAFT_ITEM or not is_dirty(states[agent].craft_id)) continue;
+        
+        auto agent_plan = sit.crafting_orchestrator(world, agent);
+        for (u8 o_agent = 0; o_agent < N; ++o_agent) {
+            if (not agent_plan.slot(o_agent).type) continue;
+            assert(not plan.slot(o_agent).type);
+            plan.slot(o_agent) = agent_plan.slot(o_agent);
+            slot_craft[o_agent] = states[agent].craft_id;
+        }
+    }
+
+    valid = true;
+    return plan;
+}
+
+template <int N>
+void Situation<N>::task_update(World const& world, Dist_cache* dist_cache, u8 agent, Diff_flat_arrays* diff) {
     assert(diff);
 
     auto& d = self(agent);
@@ -920,10 +1135,10 @@ void Situation::task_update(World const& world, Dist_cache* dist_cache, u8 agent
             agent_goto_nl(world, dist_cache, agent, t.task.where);
         }
         if (d.task_state == 1 and d.task_sleep == 0) {
-            auto& shop = get_by_id(shops, t.task.where);
+            auto& shop = get_by_id_shop(t.task.where);
             auto& item = get_by_id(shop.items, t.task.item.id);
 
-            auto const& w_item = get_by_id(world.items, item.id);
+            auto const& w_item = world.item(item.id);
             if (d.load + w_item.volume * t.task.item.amount > world.roles[agent].load) {
                 t.result.err = Task_result::MAX_LOAD;
                 d.task_state = 0xfe;
@@ -952,8 +1167,8 @@ void Situation::task_update(World const& world, Dist_cache* dist_cache, u8 agent
             agent_goto_nl(world, dist_cache, agent, t.task.where);
         }
         if (d.task_state == 1 and d.task_sleep == 0) {
-            auto& storage = get_by_id(storages, t.task.where);
-            auto const& w_item = get_by_id(world.items, t.task.item.id);
+            auto& storage = get_by_id_storage(t.task.where);
+            auto const& w_item = world.item(t.task.item.id);
             auto item = find_by_id(storage.items, t.task.item.id);
 
             if (not item or item->delivered < t.task.item.amount) {
@@ -986,7 +1201,7 @@ void Situation::task_update(World const& world, Dist_cache* dist_cache, u8 agent
 
         // Try to disprove that the agent can craft the item
         auto is_possible_at_all = [&]() -> bool {
-            Item const& item = get_by_id(world.items, t.task.item.id);
+            Item const& item = world.item(t.task.item.id);
 
             for (u8 i: item.tools) {
                 if (not is_possible_item(world, agent, t, {i, 1}, true, true)) return false;
@@ -999,13 +1214,13 @@ void Situation::task_update(World const& world, Dist_cache* dist_cache, u8 agent
         };
 
         if (d.task_state == 1 and d.task_sleep == 0) {            
-            Item const& item = get_by_id(world.items, t.task.item.id);
+            Item const& item = world.item(t.task.item.id);
 
             int overweight = d.load + item.volume * t.task.item.amount - world.roles[agent].load;
             for (Item_stack i: item.consumed) {
                 if (auto j = find_by_id(d.items, i.id)) {
                     overweight -= std::min(i.amount * t.task.item.amount, (int)j->amount)
-                        * get_by_id(world.items, j->id).volume;
+                        * world.item(j->id).volume;
                 }
             }
             if (overweight > 0) {
@@ -1019,14 +1234,14 @@ void Situation::task_update(World const& world, Dist_cache* dist_cache, u8 agent
             return;
         }
         if (d.task_state == 2 and d.task_sleep == 0) {
-            Crafting_plan plan = crafting_orchestrator(world, agent);
+            Crafting_plan<N> plan = crafting_orchestrator(world, agent);
             if (plan.slot(agent).type != Crafting_slot::EXECUTE) {
                 if (is_possible_at_all()) {
                     // One of the assists will hopefully wake us up
                     d.task_sleep = 0xff;
 
                     // Execute the crafting plan
-                    for (u8 o_agent = 0; o_agent < number_of_agents; ++o_agent) {
+                    for (u8 o_agent = 0; o_agent < N; ++o_agent) {
                         auto const& cs = plan.slot(o_agent);
                         switch (cs.type) {
                         case Crafting_slot::UNINVOLVED:
@@ -1035,17 +1250,19 @@ void Situation::task_update(World const& world, Dist_cache* dist_cache, u8 agent
                             break;
                         case Crafting_slot::USELESS:
                             self(o_agent).task_state = 0xff;
-                            self(o_agent).task_sleep = 1;
+                            set_sleep(o_agent, 1);
                             break;
                         case Crafting_slot::GIVE: {
-                            auto const& w_item = get_by_id(world.items, cs.item.id);
+                            auto const& w_item = world.item(cs.item.id);
                             self(o_agent).load  -= w_item.volume * cs.item.amount;
                             self(cs.agent).load += w_item.volume * cs.item.amount;
-                            get_by_id(self(o_agent).items, cs.item.id).amount -= cs.item.amount;
+                            auto& o_item = get_by_id(self(o_agent).items, cs.item.id);
+                            o_item.amount -= cs.item.amount;
+                            update_holding(o_agent, o_item.id, o_item.amount);
                             add_item_to_agent(cs.agent, cs.item, diff);
                             d.task_sleep = 1;
                             self(o_agent).task_state = 0xff;
-                            self(o_agent).task_sleep = 1;
+                            set_sleep(o_agent, 1);
                         } break;
                         case Crafting_slot::EXECUTE:
                         default:
@@ -1060,12 +1277,12 @@ void Situation::task_update(World const& world, Dist_cache* dist_cache, u8 agent
             }
 
             // Execute the assembly
-            Item const& item = get_by_id(world.items, t.task.item.id);
+            Item const& item = world.item(t.task.item.id);
             for (Item_stack i: item.consumed) {
                 int count = i.amount * t.task.item.amount;
-                auto const& w_i = get_by_id(world.items, i.id);
+                auto const& w_i = world.item(i.id);
                 
-                for (u8 o_agent: agent_first(agent)) {
+                for (u8 o_agent: agent_first<N>(agent)) {
                     auto& o_d = self(o_agent);
                     if (o_d.task_index == planning_max_tasks) continue;
                     auto& o_t = task(o_agent);
@@ -1081,6 +1298,7 @@ void Situation::task_update(World const& world, Dist_cache* dist_cache, u8 agent
                         u8 rem = narrow<u8>(std::min((int)j->amount, count));
                         count -= rem;
                         j->amount -= rem;
+                        update_holding(o_agent, j->id, j->amount);
                         o_d.load -= rem * w_i.volume;
                         if (count <= 0) break;
                     }
@@ -1092,7 +1310,7 @@ void Situation::task_update(World const& world, Dist_cache* dist_cache, u8 agent
             add_item_to_agent(agent, t.task.item, diff);
             d.load += item.volume * t.task.item.amount;
             
-            for (u8 o_agent = 0; o_agent < number_of_agents; ++o_agent) {
+            for (u8 o_agent = 0; o_agent < N; ++o_agent) {
                 auto const& o_d = self(o_agent);
                 if (o_d.task_index == planning_max_tasks) continue;
                 auto const& o_t = task(o_agent);
@@ -1102,7 +1320,7 @@ void Situation::task_update(World const& world, Dist_cache* dist_cache, u8 agent
                     or o_d.task_state != 2
                 ) continue;
                 self(o_agent).task_state = 0xff;
-                self(o_agent).task_sleep = d.task_sleep;
+                set_sleep(o_agent, d.task_sleep);
             }
             return;
         }
@@ -1119,7 +1337,7 @@ void Situation::task_update(World const& world, Dist_cache* dist_cache, u8 agent
             bool found = false;
             u8 o_agent;
             u8 i;
-            for (o_agent = 0; o_agent < number_of_agents; ++o_agent) {
+            for (o_agent = 0; o_agent < N; ++o_agent) {
                 for (i = self(o_agent).task_index; i < planning_max_tasks; ++i) {
                     auto const& o_t = strategy.task(o_agent, i);
                     if (o_t.task.type == Task::CRAFT_ITEM and o_t.task.craft_id == t.task.craft_id) {
@@ -1134,7 +1352,7 @@ void Situation::task_update(World const& world, Dist_cache* dist_cache, u8 agent
                 d.task_state = 0xfe;
                 return;
             }
-            auto& c_s = self(o_agent);
+            auto const& c_s = self(o_agent);
             
             int have = 0;
             if (auto item = find_by_id(d.items, t.task.item.id)) {
@@ -1149,7 +1367,7 @@ void Situation::task_update(World const& world, Dist_cache* dist_cache, u8 agent
             
             // Wake up the crafter
             if (i == c_s.task_index and c_s.task_state == 2) {
-                c_s.task_sleep = 0;
+                set_sleep(o_agent, 0);
             }
         }
         // d.task_state == 2 is handled externally by the crafter
@@ -1198,7 +1416,8 @@ void Situation::task_update(World const& world, Dist_cache* dist_cache, u8 agent
                             Item_stack deliv {j_item.id, std::min((u8)(j_item.amount - already), a_item->amount)};
                             book.add_item_to_job(t.task.job_id, deliv, diff);
                             a_item->amount -= deliv.amount;
-                            d.load -= deliv.amount * get_by_id(world.items, a_item->id).volume;
+                            update_holding(agent, a_item->id, a_item->amount);
+                            d.load -= deliv.amount * world.item(a_item->id).volume;
                             already += deliv.amount;
                             useless = false;
                         }
@@ -1249,7 +1468,7 @@ void Situation::task_update(World const& world, Dist_cache* dist_cache, u8 agent
             }
         }
         if (d.task_state == 1 and d.task_sleep == 0) {
-            auto& station = get_by_id(charging_stations, t.task.where);
+            auto& station = get_by_id_charging_station(t.task.where);
             d.task_sleep = (world.roles[agent].battery - d.charge + station.rate-1) / station.rate;
             d.task_state = 0xff;
             d.charge = world.roles[agent].battery;
@@ -1258,7 +1477,8 @@ void Situation::task_update(World const& world, Dist_cache* dist_cache, u8 agent
         
 }
 
-void Simulation_state::init(World* world_, Buffer* sit_buffer_, int sit_offset_, int sit_size_) {
+template <int N>
+void Simulation_state<N>::init(World* world_, Buffer* sit_buffer_, int sit_offset_, int sit_size_) {
     assert(world_ and sit_buffer_);
     world = world_;
     diff.init(sit_buffer_);
@@ -1269,7 +1489,7 @@ void Simulation_state::init(World* world_, Buffer* sit_buffer_, int sit_offset_,
     // Changes to orig() may be made here, probably using diff
 
     // Add some space to the inventories for performance
-    for (u8 agent = 0; agent < number_of_agents; ++agent) {
+    for (u8 agent = 0; agent < N; ++agent) {
         auto& items = orig().self(agent).items;
         for (int i = items.size(); i < inventory_size_min; ++i) {
             diff.add(items, {0, 0});
@@ -1295,38 +1515,82 @@ void Simulation_state::init(World* world_, Buffer* sit_buffer_, int sit_offset_,
     }
 
     dist_cache.reset();
-    for (u8 agent = 0; agent < number_of_agents; ++agent) {
+    for (u8 agent = 0; agent < N; ++agent) {
         dist_cache.register_pos(orig().self(agent).name, orig().self(agent).pos);
     }
     dist_cache.calc_agents();
+
+    // shop_limits is ordered by shop, in the order of the percept
+    auto const& sl = world->shop_limits;
+    shop_limits_first.reset();
+    for (auto const& shop: orig().shops) {
+        u16 j = 0;
+        while (j < sl.size() and sl[j].shop != shop.id) ++j;
+        shop_limits_first.push_back(j);
+    }
+    shop_restocked.resize(orig().shops.size());
+
+    std::fill(std::begin(item_value), std::end(item_value), 0.f);
+    for (auto const& i: world->item_costs) {
+        item_value[i.id] = i.count ? i.value() : 0.f;
+    }
 }
 
-void Simulation_state::reset() {
+template <int N>
+void Simulation_state<N>::reset() {
     // Copy the original into the working space
     buf().resize(sit_offset + orig_size);
     std::memcpy(&sit(), &orig(), orig_size);
     diff.reset();
     sit().register_arr(&diff);
     dist_cache.load_positions();
+    for (u16& i: shop_restocked) i = orig().simulation_step;
 }
 
-void Simulation_state::fast_forward() {
+template <int N>
+void Simulation_state<N>::fast_forward() {
     fast_forward(std::min(sit().simulation_step + fast_forward_steps, (int)world->steps));
 }
-void Simulation_state::fast_forward(int max_step) {
+template <int N>
+void Simulation_state<N>::fast_forward(int max_step) {
     int initial_step = sit().simulation_step;
 
-    u8 sleep_old = 0;
+    sit().sleep_dirty = 0;
+    sit().items_dirty = 0;
+    wakeups.reset();
+    for (u8 agent = 0; agent < N; ++agent) {
+        wakeup_push(agent);
+    }
+
+    // Check for expired jobs in the first iteration
+    u16 jobs_next_end = 0;
+    
     while (sit().simulation_step < max_step) {
-        for (u8 agent = 0; agent < number_of_agents; ++agent) {
+        // Collect the agents that are due now
+        u32 due = 0;
+        while (wakeups.size() and wakeups[0].step <= sit().simulation_step) {
+            Wakeup w = wakeups[0];
+            std::pop_heap(wakeups.begin(), wakeups.end(), &Wakeup::later);
+            wakeups.resize(wakeups.size() - 1);
+            if (wake_step[w.agent] != w.step) continue;
+            due |= 1u << w.agent;
+            sit().self(w.agent).task_sleep = 0;
+        }
+
+        u32 handled = 0;
+        for (u32 m = due; m; m &= m - 1) {
+            u8 agent = __builtin_ctz(m);
             auto& d = sit().self(agent);
-            if (d.task_sleep != 0xff) {
-                d.task_sleep -= std::min(sleep_old, d.task_sleep);
-            }
-
+            // Another agent may have put this one to sleep in the meantime
             if (d.task_sleep != 0 or d.task_index >= planning_max_tasks) continue;
+
+            auto const& t = sit().task(agent);
+            if (t.task.type == Task::BUY_ITEM) {
+                restock(&sit().get_by_id_shop(t.task.where) - sit().shops.begin());
+            }
             
             sit().task_update(*world, &dist_cache, agent, &diff);
+            handled |= 1u << agent;
             
             if (d.task_state == 0xff and d.task_index < planning_max_tasks) {
                 auto& r = sit().task(agent).result;
@@ -1348,78 +1612,62 @@ void Simulation_state::fast_forward(int max_step) {
             }
         }
 
+        for (u32 m = handled | sit().sleep_dirty; m; m &= m - 1) {
+            wakeup_push(__builtin_ctz(m));
+        }
+        sit().sleep_dirty = 0;
+
+        // Drop outdated entries, so that the top is the next real wakeup
+        while (wakeups.size() and wake_step[wakeups[0].agent] != wakeups[0].step) {
+            std::pop_heap(wakeups.begin(), wakeups.end(), &Wakeup::later);
+            wakeups.resize(wakeups.size() - 1);
+        }
+        
         u8 sleep_min = (u8)std::min(0xff, max_step - sit().simulation_step);
-        for (u8 agent = 0; agent < number_of_agents; ++agent) {
-            sleep_min = std::min(sleep_min, sit().self(agent).task_sleep);
+        if (wakeups.size()) {
+            sleep_min = (u8)std::min((int)sleep_min, wakeups[0].step - sit().simulation_step);
         }
         
         diff.apply();
         // If two items of the same type get added, things break. Only consider agents' inventories,
         // as this is currently the only place this happens
-        for (u8 agent = 0; agent < number_of_agents; ++agent) {
+        for (u32 m = sit().items_dirty; m; m &= m - 1) {
+            u8 agent = __builtin_ctz(m);
             auto& d = sit().self(agent);
             for (u8 i = 0; i+1 < d.items.size(); ++i) {
                 for (u8 j = i+1; j < d.items.size(); ++j) {
                     if (d.items[i].id == d.items[j].id) {
                         d.items[i].amount += d.items[j].amount;
+                        sit().update_holding(agent, d.items[i].id, d.items[i].amount);
                         d.items[j].id = 0;
                         diff.remove(d.items, j);
                     }
                 }
             }
         }
+        sit().items_dirty = 0;
         diff.apply();
+        sit().update_job_index();
 
-        // Update shops
-        int j = 0;
-        auto const& sl = world->shop_limits;
-        auto f = [](int from, int len, int restock) {
-            // This very carefully counts the number of restocks in (from, from+len]
-            return (from + len + restock) / restock - (from + restock) / restock;
-        };
-        for (auto& shop: sit().shops) {
-            u8 restocks = f(sit().simulation_step, sleep_min, shop.restock);
-            for (auto& i: shop.items) {
-                // shops and items should be sorted in some order, making this work.
-                while (sl[j].item.id != i.id or sl[j].shop != shop.id) ++j;
-
-                i.amount = std::min((u8)(i.amount + restocks), sl[j].item.amount);
-                ++j;
-            }
-
-            // TODO: If the shop does not have an item, there will be no entry to increment
-        }
+        // Shops are restocked lazily, see restock
         
         // sleep_min may be 0
         sit().simulation_step += sleep_min;
         
         // Update jobs
-        // Do not remove the items from book.delivered, because that information is nice to have.
-        for (Job const& job: sit().jobs) {
-            if (job.end < sit().simulation_step) {
-                diff.remove_ptr(sit().jobs, &job);
-            }
-        }
-        for (Auction const& job: sit().auctions) {
-            if (job.end < sit().simulation_step) {
-                diff.remove_ptr(sit().auctions, &job);
-                sit().team_money -= job.fine;
-            }
-        }
-        for (Mission const& job: sit().missions) {
-            if (job.end < sit().simulation_step) {
-                diff.remove_ptr(sit().missions, &job);
-                sit().team_money -= job.fine;
-            }
+        if (sit().simulation_step > jobs_next_end) {
+            jobs_next_end = expire_jobs();
         }
 
         // TODO: Betting on auctions
-        
-        sleep_old = sleep_min;
     }
     assert(sit().simulation_step == max_step);
+
+    for (int i = 0; i < sit().shops.size(); ++i) {
+        restock(i);
+    }
     
-    for (u8 agent = 0; agent < number_of_agents; ++agent) {
+    for (u8 agent = 0; agent < N; ++agent) {
         // Make sure that task_index holds the number of tasks executed
         auto& d = sit().self(agent);
         if (d.task_index >= planning_max_tasks
@@ -1443,7 +1691,75 @@ void Simulation_state::fast_forward(int max_step) {
     }
 }
 
-void Simulation_state::add_charging(u8 agent, u8 before) {
+template <int N>
+void Simulation_state<N>::wakeup_push(u8 agent) {
+    auto const& d = sit().self(agent);
+    if (d.task_sleep == 0xff or d.task_index >= planning_max_tasks) {
+        wake_step[agent] = wake_never;
+        return;
+    }
+    wake_step[agent] = sit().simulation_step + d.task_sleep;
+    wakeups.push_back({wake_step[agent], agent});
+    std::push_heap(wakeups.begin(), wakeups.end(), &Wakeup::later);
+}
+
+template <int N>
+void Simulation_state<N>::restock(int shop_index) {
+    auto& shop = sit().shops[shop_index];
+    u16& last = shop_restocked[shop_index];
+    int step = sit().simulation_step;
+    if (last >= step) return;
+
+    // This very carefully counts the number of restocks in (last, step]
+    int restocks = (step + shop.restock) / shop.restock - (last + shop.restock) / shop.restock;
+    last = step;
+    if (restocks == 0) return;
+    
+    auto const& sl = world->shop_limits;
+    int j = shop_limits_first[shop_index];
+    for (auto& i: shop.items) {
+        // shops and items should be sorted in some order, making this work.
+        while (sl[j].item.id != i.id or sl[j].shop != shop.id) ++j;
+
+        i.amount = (u8)std::min(i.amount + restocks, (int)sl[j].item.amount);
+        ++j;
+    }
+
+    // TODO: If the shop does not have an item, there will be no entry to increment
+}
+
+template <int N>
+u16 Simulation_state<N>::expire_jobs() {
+    // Do not remove the items from book.delivered, because that information is nice to have.
+    u16 next_end = 0xffff;
+    for (Job const& job: sit().jobs) {
+        if (job.end < sit().simulation_step) {
+            diff.remove_ptr(sit().jobs, &job);
+        } else {
+            next_end = std::min(next_end, job.end);
+        }
+    }
+    for (Auction const& job: sit().auctions) {
+        if (job.end < sit().simulation_step) {
+            diff.remove_ptr(sit().auctions, &job);
+            sit().team_money -= job.fine;
+        } else {
+            next_end = std::min(next_end, job.end);
+        }
+    }
+    for (Mission const& job: sit().missions) {
+        if (job.end < sit().simulation_step) {
+            diff.remove_ptr(sit().missions, &job);
+            sit().team_money -= job.fine;
+        } else {
+            next_end = std::min(next_end, job.end);
+        }
+    }
+    return next_end;
+}
+
+template <int N>
+void Simulation_state<N>::add_charging(u8 agent, u8 before) {
     auto& s = orig().strategy;
     u8 index;
     if (s.task(agent, before).task.type == Task::CHARGE) {
@@ -1478,7 +1794,10 @@ void Simulation_state::add_charging(u8 agent, u8 before) {
     s.task(agent, index).task = Task {Task::CHARGE, min_arg, ++s.task_next_id, {}};
 }
 
-void Simulation_state::add_item_for(u8 for_agent, u8 for_index, Item_stack for_item, bool for_tool) {
+template <int N>
+u8 Simulation_state<N>::add_item_for(u8 for_agent, u8 for_index, Item_stack for_item, bool for_tool,
+    u32 skip)
+{
     struct Viable_t {
         enum Type: u8 {
             INVALID = 0, ONLY_MOVE, BUY, RETRIEVE, CRAFT, FATTEN
@@ -1495,7 +1814,7 @@ void Simulation_state::add_item_for(u8 for_agent, u8 for_index, Item_stack for_i
     auto& t = s.task(for_agent, for_index);
 
     u8 viable_count = 0;
-    Viable_t viables[number_of_agents * 5];
+    Viable_t viables[N * 5];
 
     bool is_deliver = t.task.type == Task::DELIVER_ITEM;
 
@@ -1516,12 +1835,17 @@ void Simulation_state::add_item_for(u8 for_agent, u8 for_index, Item_stack for_i
         }
     }
     
-    auto const& w_item = get_by_id(world->items, for_item.id);
-    bool may_craft = w_item.consumed.size() != 0;
+    auto const& w_item = world->item(for_item.id);
+    bool may_craft = world->recipe(for_item.id).depth > 0;
     
-    for (u8 agent = 0; agent < number_of_agents; ++agent) {
+    for (u8 agent = 0; agent < N; ++agent) {
+        // The results of the last simulation do not match its tasks anymore
+        if (skip >> agent & 1) {
+            continue;
+        }
+        
         // Can the agent handle the tool?
-        if (for_tool and not world->roles[agent].tools.count(for_item.id)) {
+        if (for_tool and not world->can_use_tool(agent, for_item.id)) {
             continue;
         }
 
@@ -1567,8 +1891,10 @@ void Simulation_state::add_item_for(u8 for_agent, u8 for_index, Item_stack for_i
         
         // Does the agent have the item already?
         u8 have = 0;
-        if (auto item = find_by_id(sit().self(agent).items, for_item.id)) {
-            have = involved ? 0 : std::min(item->amount, for_item.amount);
+        if (not involved and sit().holds(agent, for_item.id)) {
+            if (auto item = find_by_id(sit().self(agent).items, for_item.id)) {
+                have = std::min(item->amount, for_item.amount);
+            }
         }
 
         // Fattening
@@ -1649,7 +1975,7 @@ void Simulation_state::add_item_for(u8 for_agent, u8 for_index, Item_stack for_i
     auto way = rng.choose_weighted(viables, viable_count);
     if (not way) {
         s.pop_task(for_agent, for_index);
-        return;
+        return 0xff;
     }
 
     u8 agent = way->agent;
@@ -1758,16 +2084,19 @@ void Simulation_state::add_item_for(u8 for_agent, u8 for_index, Item_stack for_i
     } else {
         assert(false);
     }
+    return agent;
 }
 
-void Simulation_state::remove_task(u8 agent, u8 index) {
+template <int N>
+void Simulation_state<N>::remove_task(u8 agent, u8 index) {
     orig().strategy.pop_task(agent, index);
 }
 
-void Simulation_state::reduce_load(u8 agent, u8 index) {
+template <int N>
+void Simulation_state<N>::reduce_load(u8 agent, u8 index) {
     int space = world->roles[agent].load - sit().self(agent).load;
     auto& t = orig().strategy.task(agent, index);
-    int possible = space / get_by_id(world->items, t.task.item.id).volume;
+    int possible = space / world->item(t.task.item.id).volume;
     if (possible == 0) {
         orig().strategy.pop_task(agent, index);
     } else {
@@ -1775,7 +2104,8 @@ void Simulation_state::reduce_load(u8 agent, u8 index) {
     }
 }
 
-void Simulation_state::reduce_buy(u8 agent, u8 index, Item_stack arg) {
+template <int N>
+void Simulation_state<N>::reduce_buy(u8 agent, u8 index, Item_stack arg) {
     auto& t = orig().strategy.task(agent, index);
     if (arg.amount < t.task.item.amount) {
         t.task.item.amount -= arg.amount;
@@ -1784,7 +2114,8 @@ void Simulation_state::reduce_buy(u8 agent, u8 index, Item_stack arg) {
     }
 }
 
-void Simulation_state::reduce_assist(u8 agent, u8 index, Item_stack arg) {
+template <int N>
+void Simulation_state<N>::reduce_assist(u8 agent, u8 index, Item_stack arg) {
     auto& t = orig().strategy.task(agent, index);
     if (arg.amount < t.task.item.amount) {
         t.task.item.amount -= arg.amount;
@@ -1793,15 +2124,142 @@ void Simulation_state::reduce_assist(u8 agent, u8 index, Item_stack arg) {
     }
 }
 
-void Strategy::insert_task(u8 agent, u8 index, Task task_) {
+template <int N>
+void Strategy<N>::insert_task(u8 agent, u8 index, Task task_) {
     for (u8 i = planning_max_tasks - 1; i > index; --i) {
         task(agent, i) = task(agent, i-1);
     }
     task(agent, index).task = task_;
 }
 
-bool Simulation_state::fix_errors() {
+// The tasks in a Strategy_store are packed as a u16 containing the index of the slot (7 bits), the
+// type (3 bits) and fixer_it (3 bits), followed by the other fields.
+static void pack_task(int slot, Task const& t, u8* into) {
+    assert(slot < 128 and t.type < 8 and t.fixer_it < 8);
+    u16 head = slot | t.type << 7 | t.fixer_it << 10;
+    std::memcpy(into,     &head,      2);
+    std::memcpy(into + 2, &t.where,   1);
+    std::memcpy(into + 3, &t.cnt,     1);
+    std::memcpy(into + 4, &t.id,      2);
+    std::memcpy(into + 6, &t.item,    2);
+    std::memcpy(into + 8, &t.job_id,  2);
+}
+static int unpack_task(u8 const* from, Task* t) {
+    u16 head;
+    std::memcpy(&head, from, 2);
+    *t = Task {};
+    t->type     = head >> 7  & 7;
+    t->fixer_it = head >> 10 & 7;
+    std::memcpy(&t->where,  from + 2, 1);
+    std::memcpy(&t->cnt,    from + 3, 1);
+    std::memcpy(&t->id,     from + 4, 2);
+    std::memcpy(&t->item,   from + 6, 2);
+    std::memcpy(&t->job_id, from + 8, 2);
+    return head & 127;
+}
+
+template <int N>
+int Strategy_store<N>::add(Strategy<N> const& s, int base, Strategy<N> const* base_tasks) {
+    static_assert(N * planning_max_tasks <= 128, "pack_task uses 7 bits for the slot");
+    static_assert(sizeof(Task) == task_size, "Task should not contain padding");
+    
+    Entry e;
+    e.data = data.size();
+    e.s_id = s.s_id;
+    e.parent = s.parent;
+    e.task_next_id = s.task_next_id;
+    e.count = 0;
+    if (base != -1 and entries[base].depth < strategy_store_depth_max) {
+        assert(base_tasks);
+        e.base = base;
+        e.depth = entries[base].depth + 1;
+    } else {
+        e.base = -1;
+        e.depth = 0;
+    }
+
+    Task empty {};
+    for (int i = 0; i < N * planning_max_tasks; ++i) {
+        Task const& t = s.m_tasks[i].task;
+        Task const& b = e.base == -1 ? empty : base_tasks->m_tasks[i].task;
+        if (std::memcmp(&t, &b, sizeof(Task)) == 0) continue;
+        int offset = data.size();
+        data.resize(offset + task_size);
+        pack_task(i, t, data.data() + offset);
+        ++e.count;
+    }
+    entries.push_back(e);
+    return entries.size() - 1;
+}
+
+template <int N>
+void Strategy_store<N>::get(int index, Strategy<N>* into) const {
+    assert(into);
+    Entry const& e = entries[index];
+    if (e.base == -1) {
+        std::memset(into->m_tasks, 0, sizeof(into->m_tasks));
+    } else {
+        get(e.base, into);
+    }
+    for (int i = 0; i < e.count; ++i) {
+        Task t;
+        int slot = unpack_task(data.data() + e.data + i * task_size, &t);
+        into->m_tasks[slot].task = t;
+    }
+    into->s_id = e.s_id;
+    into->parent = e.parent;
+    into->task_next_id = e.task_next_id;
+}
+
+template <int N>
+u8 Simulation_state<N>::fix_task(u8 agent, u8 index, u32 skip) {
+    auto& r = sit().strategy.task(agent, index).result;
+    auto& ot = orig().strategy.task(agent, index);
+    ++ot.task.fixer_it;
+
+    u8 other = 0xff;
+    if (ot.task.fixer_it > fixer_it_limit) {
+        remove_task(agent, index);
+    } else if (r.err == Task_result::OUT_OF_BATTERY) {
+        add_charging(agent, index);
+    } else if (r.err == Task_result::CRAFT_NO_ITEM) {
+        other = add_item_for(agent, index, r.err_arg, false, skip);
+    } else if (r.err == Task_result::CRAFT_NO_ITEM_SELF) {
+        other = add_item_for(agent, index, r.err_arg, false, skip);
+    } else if (r.err == Task_result::CRAFT_NO_TOOL) {
+        other = add_item_for(agent, index, r.err_arg, true, skip);
+    } else if (r.err == Task_result::NO_CRAFTER_FOUND) {
+        remove_task(agent, index);
+    } else if (r.err == Task_result::NOT_IN_INVENTORY) {
+        other = add_item_for(agent, index, r.err_arg, false, skip);
+    } else if (r.err == Task_result::NOT_VALID_FOR_JOB) {
+        remove_task(agent, index);
+    } else if (r.err == Task_result::NO_SUCH_JOB) {
+        remove_task(agent, index);
+    } else if (r.err == Task_result::MAX_LOAD) {
+        reduce_load(agent, index);
+    } else if (r.err == Task_result::ASSIST_USELESS) {
+        reduce_assist(agent, index, r.err_arg);
+    } else if (r.err == Task_result::DELIVERY_USELESS) {
+        remove_task(agent, index);
+    } else if (r.err == Task_result::NOT_IN_SHOP) {
+        reduce_buy(agent, index, r.err_arg);
+    } else {
+        assert(false);
+    }
+    
+    JDBG_D < agent < index < r ,0;
+    return other;
+}
+
+template <int N>
+bool Simulation_state<N>::fix_errors() {
     //debug_flag = orig().strategy.s_id == 3170 or orig().strategy.s_id == 3169;
+    struct Failure_t {
+        u16 index_diff;
+        u8 agent;
+    };
+    
     bool dirty = false;
     for (int it = 0; it < fixer_iterations; ++it) {
         reset();
@@ -1810,9 +2268,10 @@ bool Simulation_state::fix_errors() {
         JDBG_D < sit().strategy.p_results() ,1;
         JDBG_D < orig().strategy.p_tasks() ,0;
 
-        u8 best_agent = number_of_agents;
-        int value = std::numeric_limits<int>::max();
-        for (u8 agent = 0; agent < number_of_agents; ++agent) {
+        // Collect all failed tasks, the ones created first come first
+        Failure_t failures[N];
+        int failure_count = 0;
+        for (u8 agent = 0; agent < N; ++agent) {
             auto& d = sit().self(agent);
             if (d.task_state != 0xfe) continue;
             assert(d.task_index > 0);
@@ -1825,65 +2284,60 @@ bool Simulation_state::fix_errors() {
 
             auto& ot = orig().strategy.task(agent, index);
             u16 index_diff = orig().strategy.task_next_id + (u16)(-ot.task.id);
-            if (index_diff < value) {
-                best_agent = agent;
-                value = index_diff;
-            }
+            failures[failure_count++] = {index_diff, agent};
         }
+        std::sort(failures, failures + failure_count, [](Failure_t a, Failure_t b) {
+            return a.index_diff < b.index_diff or (a.index_diff == b.index_diff and a.agent < b.agent);
+        });
 
-        if (best_agent != number_of_agents) {
-            u8 agent = best_agent;
-            
-            auto& d = sit().self(agent);
-            u8 index = d.task_index - 1;
-            auto& r = sit().strategy.task(agent, index).result;
-
-            auto& ot = orig().strategy.task(agent, index);
-            ++ot.task.fixer_it;
-            dirty = true;
-            if (ot.task.fixer_it > fixer_it_limit) {
-                remove_task(agent, index);
-            } else if (r.err == Task_result::OUT_OF_BATTERY) {
-                add_charging(agent, index);
-            } else if (r.err == Task_result::CRAFT_NO_ITEM) {
-                add_item_for(agent, index, r.err_arg, false);
-            } else if (r.err == Task_result::CRAFT_NO_ITEM_SELF) {
-                add_item_for(agent, index, r.err_arg, false);
-            } else if (r.err == Task_result::CRAFT_NO_TOOL) {
-                add_item_for(agent, index, r.err_arg, true);
-            } else if (r.err == Task_result::NO_CRAFTER_FOUND) {
-                remove_task(agent, index);
-            } else if (r.err == Task_result::NOT_IN_INVENTORY) {
-                add_item_for(agent, index, r.err_arg, false);
-            } else if (r.err == Task_result::NOT_VALID_FOR_JOB) {
-                remove_task(agent, index);
-            } else if (r.err == Task_result::NO_SUCH_JOB) {
-                remove_task(agent, index);
-            } else if (r.err == Task_result::MAX_LOAD) {
-                reduce_load(agent, index);
-            } else if (r.err == Task_result::ASSIST_USELESS) {
-                reduce_assist(agent, index, r.err_arg);
-            } else if (r.err == Task_result::DELIVERY_USELESS) {
-                remove_task(agent, index);
-            } else if (r.err == Task_result::NOT_IN_SHOP) {
-                reduce_buy(agent, index, r.err_arg);
-            } else {
-                assert(false);
-            }
-            
-            JDBG_D < it < agent < index < r ,0;
-        } else {
+        if (failure_count == 0) {
             if (fix_deadlock()) {
                 dirty = true;
+                continue;
             } else {
                 break;
             }
         }
+
+        // Fix as many of them as possible before simulating again. A fix must not touch the tasks
+        // of an agent fixed before, as the indices would be off, nor the same craft. That includes
+        // the agents that received tasks from add_item_for. Missing items may well be caused by an
+        // earlier failure, so these are only fixed if they come first.
+        u32 touched = 0;
+        u16 crafts[fixer_fixes_max];
+        int fix_count = 0;
+        for (int k = 0; k < failure_count and fix_count < fixer_fixes_max; ++k) {
+            u8 agent = failures[k].agent;
+            if (touched >> agent & 1) continue;
+            
+            u8 index = sit().self(agent).task_index - 1;
+            auto const& r = sit().strategy.task(agent, index).result;
+            auto const& ot = orig().strategy.task(agent, index);
+            
+            bool may_depend = r.err == Task_result::CRAFT_NO_ITEM
+                or r.err == Task_result::CRAFT_NO_ITEM_SELF
+                or r.err == Task_result::CRAFT_NO_TOOL
+                or r.err == Task_result::NO_CRAFTER_FOUND
+                or r.err == Task_result::NOT_IN_INVENTORY
+                or r.err == Task_result::ASSIST_USELESS;
+            if (fix_count > 0 and may_depend) continue;
+
+            u16 craft = ot.task.type == Task::CRAFT_ITEM or ot.task.type == Task::CRAFT_ASSIST
+                ? ot.task.craft_id : 0;
+            if (craft and std::count(crafts, crafts + fix_count, craft)) continue;
+
+            crafts[fix_count++] = craft;
+            u8 other = fix_task(agent, index, touched);
+            touched |= 1u << agent;
+            if (other != 0xff) touched |= 1u << other;
+        }
+        dirty = true;
     }
     return dirty;
 }
     
-bool Simulation_state::fix_deadlock() {
+template <int N>
+bool Simulation_state<N>::fix_deadlock() {
     // Detect deadlock
     struct Edge_t {
         u8 a, b;
@@ -1895,17 +2349,17 @@ bool Simulation_state::fix_deadlock() {
         bool invalid;
     };
 
-    u8 max_nodes = narrow<u8>(number_of_agents * planning_max_tasks);
+    u8 max_nodes = narrow<u8>(N * planning_max_tasks);
     Array_view_mut<Node_t> nodes {(Node_t*)alloca(max_nodes * sizeof(Node_t)), max_nodes};
     std::memset(nodes.begin(), 0, nodes.as_bytes().size());
     u8 node_count = 0;
 
-    u8 max_edges = narrow<u8>(number_of_agents * (planning_max_tasks - 1));
+    u8 max_edges = narrow<u8>(N * (planning_max_tasks - 1));
     Array_view_mut<Edge_t> edges {(Edge_t*)alloca(max_nodes * sizeof(Edge_t)), max_edges};
     u8 edge_count = 0;
 
     // Build the dependency graph
-    for (u8 agent = 0; agent < number_of_agents; ++agent) {
+    for (u8 agent = 0; agent < N; ++agent) {
         u8 last_node = 0xff;
         u16 last_edge_id;
         for (u8 i = 0; i < planning_max_tasks; ++i) {
@@ -1977,13 +2431,13 @@ bool Simulation_state::fix_deadlock() {
 
     // Find the slot
     u8 agent, index;
-    for (agent = 0; agent < number_of_agents; ++agent) {
+    for (agent = 0; agent < N; ++agent) {
         for (index = 0; index < planning_max_tasks; ++index) {
             if (orig().strategy.task(agent, index).task.id == task_id) break;
         }
         if (index < planning_max_tasks) break;
     }
-    assert(agent != number_of_agents);
+    assert(agent != N);
 
     // Move the associated task behind all other tasks that are in the circle and update their ids
     u8 to_index = 0xff;
@@ -2006,12 +2460,13 @@ bool Simulation_state::fix_deadlock() {
     return true;
 }
 
-bool Simulation_state::create_work() {
-    u8 viable_agents[number_of_agents];
+template <int N>
+bool Simulation_state<N>::create_work() {
+    u8 viable_agents[N];
     int viable_agents_count = 0;
     
     auto& s = orig().strategy;
-    for (u8 agent = 0; agent < number_of_agents; ++agent) {
+    for (u8 agent = 0; agent < N; ++agent) {
         int count = 0;
         for (u8 i = 0; i < planning_max_tasks; ++i) {
             count += s.task(agent, i).task.type != Task::NONE;
@@ -2030,7 +2485,7 @@ bool Simulation_state::create_work() {
     if (viable_agents_count == 0) return false;
 
     bool has_err = false;
-    for (u8 agent = 0; agent < number_of_agents; ++agent) {
+    for (u8 agent = 0; agent < N; ++agent) {
         auto const& d = sit().self(agent);
         if (d.task_index > 0 and sit().strategy.task(agent, d.task_index - 1).result.err) {
             has_err = true;
@@ -2038,38 +2493,33 @@ bool Simulation_state::create_work() {
     }
     if (has_err) return false;
 
-    struct Viable_job_t {
-        u16 rating;
-        u16 job_id;
-    };
-
-    Viable_job_t* viable_jobs = (Viable_job_t*)alloca(orig().jobs.size() * sizeof(Viable_job_t));
-    int viable_job_count = 0;
+    // Collect the started jobs once, so that checking a job is a lookup
+    started_jobs.reset();
+    for (auto const& t: sit().strategy.m_tasks) {
+        if (t.task.type == Task::DELIVER_ITEM) started_jobs.push_back(t.task.job_id);
+    }
+    for (auto i: sit().book.delivered) {
+        started_jobs.push_back(i.job_id);
+    }
+    std::sort(started_jobs.begin(), started_jobs.end());
+    started_jobs.resize(std::unique(started_jobs.begin(), started_jobs.end()) - started_jobs.begin());
 
+    viable_jobs.reset();
     auto add_job = [&](Job const& job, int reward, int fine) {
-        bool started = false;
-        for (u8 agent = 0; agent < number_of_agents; ++agent) {
-            for (u8 i = 0; i < planning_max_tasks; ++i) {
-                auto const& t = sit().strategy.task(agent, i);
-                started |= t.task.type == Task::DELIVER_ITEM and t.task.job_id == job.id;
-            }
-        }
-        for (auto i: sit().book.delivered) {
-            started |= i.job_id == job.id;
-        }
+        bool started = std::binary_search(started_jobs.begin(), started_jobs.end(), job.id);
         if (not started and job.required.size()+2 > viable_agents_count) return;
 
         int cost = 0;
         int complexity = 0;
         for (auto i: job.required) {
             int need = i.amount;
-            for (u8 agent = 0; agent < number_of_agents; ++agent) {
-                if (auto j = find_by_id(sit().self(agent).items, i.id)) {
+            for (u32 m = sit().item_holders[i.id]; m; m &= m - 1) {
+                if (auto j = find_by_id(sit().self(__builtin_ctz(m)).items, i.id)) {
                     need -= std::min((int)j->amount, need);
                 }
             }
 
-            auto const& i_cost = get_by_id(world->item_costs, i.id);
+            auto const& i_cost = world->item_cost(i.id);
             cost += i_cost.value() * need;
             cost += (u8)((float)(i_cost.value() * (i.amount - need)) * rate_job_havefac) ;
             complexity += i_cost.craftval * i.amount;
@@ -2082,7 +2532,7 @@ bool Simulation_state::create_work() {
         rating += started ? rate_job_started : 0;
         rating += (u8)(profit * rate_job_profit);
         if (rating > 0) {
-            viable_jobs[viable_job_count++] = {rating, job.id};
+            viable_jobs.push_back({rating, job.id});
         }
     };
     
@@ -2103,8 +2553,8 @@ bool Simulation_state::create_work() {
     }
 
     bool dirty = false;
-    if (viable_job_count > 0) {
-        u16 job_id = rng.choose_weighted(viable_jobs, viable_job_count)->job_id;
+    if (viable_jobs.size() > 0) {
+        u16 job_id = rng.choose_weighted(viable_jobs.data(), viable_jobs.size())->job_id;
         u8 job_type;
         Job const& job = sit().get_by_id_job(job_id, &job_type);
 
@@ -2139,7 +2589,7 @@ bool Simulation_state::create_work() {
     } else {
         // Let the agents buy tools
 
-        u8 prior_tools[number_of_agents] = {};
+        u8 prior_tools[N] = {};
         
         constexpr int viable_tool_max = 16;
         u8* viable_tools = (u8*)alloca(viable_tool_max * sizeof(u8));
@@ -2152,12 +2602,7 @@ bool Simulation_state::create_work() {
 
             int viable_tool_count = 0;
             for (u8 tool: world->roles[agent].tools) {
-                bool already = false;
-                for (u8 o_agent = 0; o_agent < number_of_agents; ++o_agent) {
-                    if (auto item = find_by_id(sit().self(o_agent).items, tool)) {
-                        already |= item->amount > 0;
-                    }
-                }
+                bool already = sit().item_holders[tool] != 0;
                 for (u8 i: prior_tools) {
                     already |= tool == i;
                 }
@@ -2201,7 +2646,8 @@ bool Simulation_state::create_work() {
     return dirty;
 }
 
-bool Simulation_state::optimize() {    
+template <int N>
+bool Simulation_state<N>::optimize() {    
     for (int it = 0; it < optimizer_iterations; ++it) {
         reset();
         fast_forward();
@@ -2210,13 +2656,13 @@ bool Simulation_state::optimize() {
         auto& s = orig().strategy;
         
         // Remove unnecessary items
-        for (u8 agent = 0; agent < number_of_agents; ++agent) {
+        for (u8 agent = 0; agent < N; ++agent) {
             auto& d = sit().self(agent);
             if (last_time(agent) == sit().simulation_step) continue;
             if (d.task_index and sit().strategy.task(agent, d.task_index - 1).result.err) continue;
             
             for (auto const& item: d.items) {
-                int extra = item.amount - world->roles[agent].tools.count(item.id);
+                int extra = item.amount - world->can_use_tool(agent, item.id);
                 if (extra <= 0) continue;
         
                 for (u8 i = planning_max_tasks - 1; i < planning_max_tasks; --i) {
@@ -2235,7 +2681,7 @@ bool Simulation_state::optimize() {
         }
 
         // Remove tasks not finished in time
-        for (u8 agent = 0; agent < number_of_agents; ++agent) {
+        for (u8 agent = 0; agent < N; ++agent) {
             auto& d = sit().self(agent);
             if (d.task_index == 0 or last_time(agent) < world->steps) continue;
             
@@ -2250,7 +2696,8 @@ bool Simulation_state::optimize() {
     return true;
 }
 
-float Simulation_state::rate() {
+template <int N>
+float Simulation_state<N>::rate() {
     reset();
     fast_forward();
         
@@ -2258,10 +2705,10 @@ float Simulation_state::rate() {
 
     // Count all items inside the agents inventory
     float item_rating = 0;
-    for (u8 agent = 0; agent < number_of_agents; ++agent) {
+    for (u8 agent = 0; agent < N; ++agent) {
         for (auto const& i: sit().self(agent).items) {
             if (i.id == 0) continue;
-            item_rating += get_by_id(world->item_costs, i.id).value() * i.amount;
+            item_rating += item_value[i.id] * i.amount;
         }
     }
     float fadeoff = std::min(1.f, (world->steps - sit().simulation_step) / rate_fadeoff);
@@ -2269,7 +2716,7 @@ float Simulation_state::rate() {
     //rating += item_rating * rate_val_item;
     
 
-    for (u8 agent = 0; agent < number_of_agents; ++agent) {
+    for (u8 agent = 0; agent < N; ++agent) {
         if (sit().strategy.task(agent, 0).result.err) {
             rating -= rate_error;
         }
@@ -2279,7 +2726,8 @@ float Simulation_state::rate() {
     return rating;
 }
 
-void Simulation_state::auction_bets(Array<Auction_bet>* bets) {
+template <int N>
+void Simulation_state<N>::auction_bets(Array<Auction_bet>* bets) {
     assert(bets);
     bets->reset();
     bets->reserve(max_bets_per_step);
@@ -2291,13 +2739,13 @@ void Simulation_state::auction_bets(Array<Auction_bet>* bets) {
         int complexity = 0;
         for (auto i: job.required) {
             int need = i.amount;
-            for (u8 agent = 0; agent < number_of_agents; ++agent) {
-                if (auto j = find_by_id(sit().self(agent).items, i.id)) {
+            for (u32 m = sit().item_holders[i.id]; m; m &= m - 1) {
+                if (auto j = find_by_id(sit().self(__builtin_ctz(m)).items, i.id)) {
                     need -= std::min((int)j->amount, need);
                 }
             }
 
-            auto const& i_cost = get_by_id(world->item_costs, i.id);
+            auto const& i_cost = world->item_cost(i.id);
             cost += i_cost.value() * need;
             cost += (u8)((float)(i_cost.value() * (i.amount - need)) * rate_job_havefac) ;
             complexity += i_cost.craftval * i.amount;
@@ -2318,5 +2766,20 @@ void Simulation_state::auction_bets(Array<Auction_bet>* bets) {
     }
 }
 
+template struct Strategy<16>;
+template struct Strategy<20>;
+template struct Strategy<28>;
+template struct Strategy_store<16>;
+template struct Strategy_store<20>;
+template struct Strategy_store<28>;
+template class Situation<16>;
+template class Situation<20>;
+template class Situation<28>;
+template struct Crafting_planner<16>;
+template struct Crafting_planner<20>;
+template struct Crafting_planner<28>;
+template class Simulation_state<16>;
+template class Simulation_state<20>;
+template class Simulation_state<28>;
 
 } /* end of namespace jup */
@@ -11,8 +11,25 @@
 
 namespace jup {
 
+// The largest team the planner supports
 constexpr int number_of_agents = agents_per_team;
 constexpr int planning_max_tasks = 4;
+static_assert(number_of_agents <= 32, "Situation uses u32 bitmasks over the agents");
+
+// Strategy, Crafting_plan, Situation, Crafting_planner and Simulation_state are templates over the
+// number of agents N, so that nothing is spent on the slots of agents that are not in the team.
+// They are instantiated for these sizes (see the end of simulation.cpp), a team uses the smallest
+// one it fits into.
+constexpr int team_sizes[] = {16, 20, 28};
+static_assert(team_sizes[2] == number_of_agents, "The largest team size has to be number_of_agents");
+
+// The instantiation used for a team of the given size, 0 if it is too large
+constexpr int team_size_for(int agents) {
+    for (int i: team_sizes) {
+        if (agents <= i) return i;
+    }
+    return 0;
+}
 
 constexpr u8 fast_forward_steps = 80;
 constexpr u8 fixer_iterations = 40;
@@ -39,6 +56,8 @@ constexpr float rate_job_havefac = 0.5f;
 constexpr float rate_job_profit  = 0.05f;
 
 constexpr u8 fixer_it_limit = 5;
+// Maximum number of failed tasks fix_errors repairs per simulation, 1 fixes only the oldest one
+constexpr int fixer_fixes_max = 8;
 
 constexpr float rate_val_item  = 0.83f;
 constexpr float rate_fadeoff   = 40;
@@ -111,6 +130,12 @@ struct Item_cost {
     u16 value() const { return sum / count; }
 };
 
+// The place of an item in the recipe DAG
+struct Recipe {
+    u8 id;
+    u8 depth; // 0 for base items, else one more than the maximum depth of the parts
+};
+
 class World {
 public:
     World(Simulation const& s0, Graph* graph, Buffer* containing);
@@ -127,10 +152,38 @@ public:
     Flat_array<Role> roles;
     Graph* graph;
 
+    // The recipes, ordered so that the parts of an item come before it
+    Flat_array<Recipe> recipes;
+
     // Inferred knowledge
     Flat_array<Shop_limit> shop_limits;
     u16 item_costs_job = 0;
     Flat_array<Item_cost> item_costs;
+
+    // The agents (as bitmask) that can use each tool. Set by update.
+    u32 tool_agents[256] = {};
+
+    bool can_use_tool(u8 agent, u8 tool) const {
+        return tool_agents[tool] >> agent & 1;
+    }
+
+    // Index into items, item_costs and recipes by item id, 0xff if there is none
+    u8 item_index[256];
+    u8 item_cost_index[256];
+    u8 recipe_index[256];
+
+    Item const& item(u8 id) const {
+        assert(item_index[id] != 0xff);
+        return items[item_index[id]];
+    }
+    Item_cost const& item_cost(u8 id) const {
+        assert(item_cost_index[id] != 0xff);
+        return item_costs[item_cost_index[id]];
+    }
+    Recipe const& recipe(u8 id) const {
+        assert(recipe_index[id] != 0xff);
+        return recipes[recipe_index[id]];
+    }
 };
 
 struct Job_item {
@@ -168,19 +221,20 @@ struct Partial_viewer_task_result {
 };
 
 
+template <int N>
 struct Strategy {
-    Task_slot m_tasks[number_of_agents * planning_max_tasks] = {};
+    Task_slot m_tasks[N * planning_max_tasks] = {};
     u32 s_id = 0; // Can't call it id because of hacks in the debug.hpp implementation
     u32 parent = 0;
     u16 task_next_id = 0;
 
     Task_slot& task(u8 agent, u8 index) {
-        assert(0 <= agent and agent < number_of_agents);
+        assert(0 <= agent and agent < N);
         assert(0 <= index and index < planning_max_tasks);
         return m_tasks[agent * planning_max_tasks + index];
     }
     Task_slot const& task(u8 agent, u8 index) const {
-        assert(0 <= agent and agent < number_of_agents);
+        assert(0 <= agent and agent < N);
         assert(0 <= index and index < planning_max_tasks);
         return m_tasks[agent * planning_max_tasks + index];
     }
@@ -201,11 +255,49 @@ struct Strategy {
         return result;
     }
 
+    // Compares only the tasks, the results are just the output of the last simulation
     bool operator== (Strategy const& o) const {
-        return std::memcmp(m_tasks, o.m_tasks, sizeof(m_tasks)) == 0;
+        for (int i = 0; i < N * planning_max_tasks; ++i) {
+            if (std::memcmp(&m_tasks[i].task, &o.m_tasks[i].task, sizeof(Task))) return false;
+        }
+        return true;
     }
 };
 
+// Maximum number of bases a strategy in a Strategy_store may be stored relative to
+constexpr u8 strategy_store_depth_max = 8;
+
+// Stores strategies compactly. Only the tasks are kept, as the results are overwritten by each
+// simulation anyway, and only the tasks that differ from the base of the strategy. The base is
+// either another stored strategy (its parent in the search) or the empty one. Each stored task
+// takes 10 bytes, instead of the 16 of a Task_slot.
+template <int N>
+struct Strategy_store {
+    struct Entry {
+        int data;  // Offset of the tasks in data
+        int base;  // Index of the entry this is relative to, -1 for the empty strategy
+        u32 s_id, parent;
+        u16 task_next_id;
+        u8 count;  // Number of stored tasks
+        u8 depth;  // Number of bases until the empty strategy
+    };
+    static constexpr int task_size = 10;
+
+    Array<Entry> entries;
+    Array<u8> data;
+
+    void reset() { entries.reset(); data.reset(); }
+    int size() const { return entries.size(); }
+    // Bytes used for the strategies
+    int bytes() const { return entries.size() * sizeof(Entry) + data.size(); }
+
+    // Store the strategy s relative to the stored strategy base, whose tasks are base_tasks.
+    // Returns the index of the new entry.
+    int add(Strategy<N> const& s, int base = -1, Strategy<N> const* base_tasks = nullptr);
+    // Write the strategy with the given index into, with all results zeroed
+    void get(int index, Strategy<N>* into) const;
+};
+
 struct Self_sim: Self {
     u8 task_index;
     u8 task_state;
@@ -223,10 +315,15 @@ struct Crafting_slot {
     u16 extra_load;
 };
 
+template <int N>
 struct Crafting_plan {
-    Crafting_slot slots[number_of_agents];
+    Crafting_slot slots[N];
     auto& slot(u8 i) {
-        assert(0 <= i and i < number_of_agents);
+        assert(0 <= i and i < N);
+        return slots[i];
+    }
+    auto const& slot(u8 i) const {
+        assert(0 <= i and i < N);
         return slots[i];
     }
 };
@@ -238,14 +335,15 @@ struct Auction_bet {
 
 // Fully describes the dynamic data of the world. Effectively combines Percept's
 // of all agents, as well as the current strategy
+template <int N>
 class Situation {
 public:
     // Keep in mind to add any arrays here into Situation::register_arr as well
     bool initialized;
 	u16 simulation_step;
 	s32 team_money;
-	Self_sim selves[number_of_agents] = {};
-    Strategy strategy;
+	Self_sim selves[N] = {};
+    Strategy<N> strategy;
 	Flat_array<Entity> entities;
 	Flat_array<Charging_station> charging_stations;
 	Flat_array<Dump> dumps;
@@ -259,24 +357,60 @@ public:
 	Flat_array<Posted> posteds;
 
     Bookkeeping book;
+
+    // Lookup tables by id, 0xff marks ids that are not present. Facilities do not change, the
+    // tables for jobs have to be rebuilt using update_job_index after jobs are removed. Job ids
+    // are looked up relative to job_id_base, ids outside of that window are searched for.
+    enum Facility_type: u8 {
+        CHARGING_STATION, DUMP, SHOP, STORAGE, WORKSHOP
+    };
+    u8 facility_index[256];
+    u8 facility_type[256];
+    u16 job_id_base;
+    u16 job_count_indexed;
+    u8 job_index[256];
+    u8 job_type[256];
+
+    // Bit i is set if task_sleep (or the inventory, respectively) of agent i was changed while
+    // executing another agent's task_update. Simulation_state::fast_forward uses these to revisit
+    // only the agents concerned.
+    u32 sleep_dirty = 0;
+    u32 items_dirty = 0;
+
+    // The agents (as bitmask) that hold a nonzero amount of each item. This has to be kept in sync
+    // with the inventories, use update_holding after changing an amount. Items added by pending
+    // diffs are already included, so a set bit only means that the inventory has to be checked.
+    u32 item_holders[256] = {};
     
     auto& self(u8 agent) {
-        assert(0 <= agent and agent < number_of_agents);
+        assert(0 <= agent and agent < N);
         return selves[agent];
     }
     auto const& self(u8 agent) const {
-        assert(0 <= agent and agent < number_of_agents);
+        assert(0 <= agent and agent < N);
         return selves[agent];
     }
     auto& task(u8 agent) {
-        assert(0 <= agent and agent < number_of_agents);
+        assert(0 <= agent and agent < N);
         return strategy.task(agent, selves[agent].task_index);
     }
     auto const& task(u8 agent) const {
-        assert(0 <= agent and agent < number_of_agents);
+        assert(0 <= agent and agent < N);
         return strategy.task(agent, selves[agent].task_index);
     }
 
+    bool holds(u8 agent, u8 item) const {
+        return item_holders[item] >> agent & 1;
+    }
+    void update_holding(u8 agent, u8 item, int amount) {
+        if (amount > 0) {
+            item_holders[item] |= 1u << agent;
+        } else {
+            item_holders[item] &= ~(1u << agent);
+        }
+    }
+    void index_items(u8 agent);
+
     Situation() {}
     Situation(Percept const& p0, Situation const* sit_old /* = nullptr */, Buffer* containing);
     void update(Percept const& p, u8 id, Buffer* containing);
@@ -296,18 +430,93 @@ public:
 
     bool agent_goto(u8 where, u8 agent, Buffer* into);
 
+    void index_facilities();
+    void index_jobs();
+    void update_job_index() {
+        int count = jobs.size() + auctions.size() + missions.size() + posteds.size();
+        if (count != job_count_indexed) index_jobs();
+    }
+    
+    Shop& get_by_id_shop(u8 id) {
+        assert(facility_type[id] == SHOP);
+        return shops[facility_index[id]];
+    }
+    Storage& get_by_id_storage(u8 id) {
+        assert(facility_type[id] == STORAGE);
+        return storages[facility_index[id]];
+    }
+    Charging_station& get_by_id_charging_station(u8 id) {
+        assert(facility_type[id] == CHARGING_STATION);
+        return charging_stations[facility_index[id]];
+    }
+    
     Pos find_pos(u8 id) const;
     bool is_possible_item(World const& world, u8 agent, Task_slot& t, Item_stack i, bool is_tool, bool at_all,
-        Crafting_plan* plan = nullptr);
-    Crafting_plan crafting_orchestrator(World const& world, u8 agent);
-    Crafting_plan combined_plan(World const& world);
+        Crafting_plan<N>* plan = nullptr);
+    Crafting_plan<N> crafting_orchestrator(World const& world, u8 agent);
+    Crafting_plan<N> combined_plan(World const& world);
 
     Job* find_by_id_job(u16 id, u8* type = nullptr);
     Job& get_by_id_job(u16 id, u8* type = nullptr);
 
     void add_item_to_agent(u8 agent, Item_stack item, Diff_flat_arrays* diff);
+
+    // Change the task_sleep of an agent other than the one currently updated
+    void set_sleep(u8 agent, u8 sleep) {
+        self(agent).task_sleep = sleep;
+        sleep_dirty |= 1u << agent;
+    }
 };
 
+// Maintains the result of Situation::combined_plan. The plan of a crafter only depends on the
+// agents working on the same craft, so update only recomputes the crafts which one of the agents
+// joined or left, or where one of them changed, since the last call.
+template <int N>
+struct Crafting_planner {
+    // Everything about an agent the plans depend on
+    struct Agent_state {
+        u8 type, where;
+        u16 craft_id;
+        Item_stack item;
+        u8 task_index, task_state, task_sleep, facility;
+        u16 load;
+        u32 items_hash;
+
+        bool operator== (Agent_state const& o) const {
+            return type == o.type and where == o.where and craft_id == o.craft_id
+                and item == o.item and task_index == o.task_index and task_state == o.task_state
+                and task_sleep == o.task_sleep and facility == o.facility and load == o.load
+                and items_hash == o.items_hash;
+        }
+        // The craft the agent takes part in, 0 if none
+        u16 craft() const {
+            return type == Task::CRAFT_ITEM or type == Task::CRAFT_ASSIST ? craft_id : 0;
+        }
+    };
+
+    Crafting_plan<N> plan;
+    Agent_state states[N];
+    u16 slot_craft[N]; // The craft whose plan set the slot, 0 if none
+    bool valid = false;
+
+    // Forget everything, the next update recomputes the whole plan
+    void reset() { valid = false; }
+    Crafting_plan<N> const& update(Situation<N>& sit, World const& world);
+};
+
+struct Wakeup {
+    u16 step;
+    u8 agent;
+
+    // The std heap functions build a max-heap, so this puts the earliest wakeup on top
+    static bool later(Wakeup a, Wakeup b) {
+        return a.step > b.step or (a.step == b.step and a.agent > b.agent);
+    }
+};
+
+constexpr u16 wake_never = 0xffff;
+
+template <int N>
 class Simulation_state {
 public:
     World* world;
@@ -318,6 +527,28 @@ public:
     int orig_offset, orig_size;
     int sit_offset;
 
+    // Pending wakeups of the agents, as a heap. An entry is outdated if it does not match
+    // wake_step, these are skipped.
+    Array<Wakeup> wakeups;
+    u16 wake_step[N];
+
+    // For each shop (by index), the step up to which restocks have been applied, and the index
+    // of its first entry in world->shop_limits
+    Array<u16> shop_restocked;
+    Array<u16> shop_limits_first;
+
+    // The value of each item, by id, as used by rate
+    float item_value[256];
+
+    // Scratch space for create_work. started_jobs holds the ids of all jobs that are delivered to
+    // by a task or have items delivered already, sorted.
+    struct Viable_job {
+        u16 rating;
+        u16 job_id;
+    };
+    Array<u16> started_jobs;
+    Array<Viable_job> viable_jobs;
+
     Simulation_state() {}
     Simulation_state(World* world, Buffer* sit_buffer, int sit_offset, int sit_size) {
         init(world, sit_buffer, sit_offset, sit_size);
@@ -327,12 +558,15 @@ public:
     void reset();
     
     auto& buf()  { return *diff.container; }
-    auto& sit()  { return diff.container->get<Situation>(sit_offset ); }
-    auto& orig() { return diff.container->get<Situation>(orig_offset); }
+    Situation<N>& sit()  { return diff.container->get<Situation<N>>(sit_offset ); }
+    Situation<N>& orig() { return diff.container->get<Situation<N>>(orig_offset); }
     
     void add_charging(u8 agent, u8 before);
     void fast_forward();
     void fast_forward(int max_step);
+    void wakeup_push(u8 agent);
+    void restock(int shop_index);
+    u16 expire_jobs();
 
     bool fix_errors();
     bool create_work();
@@ -345,7 +579,12 @@ public:
     void reduce_load(u8 agent, u8 index);
     void reduce_buy(u8 agent, u8 index, Item_stack arg);
     void reduce_assist(u8 agent, u8 index, Item_stack arg);
-    void add_item_for(u8 for_agent, u8 for_index, Item_stack for_item, bool for_tool);
+    // Returns the agent that received the new tasks, or 0xff if the task was removed instead. The
+    // agents in the mask skip are not considered.
+    u8 add_item_for(u8 for_agent, u8 for_index, Item_stack for_item, bool for_tool, u32 skip = 0);
+    // Fix the error of a failed task, without changing the tasks of the agents in the mask skip.
+    // Returns another agent whose tasks were changed, or 0xff.
+    u8 fix_task(u8 agent, u8 index, u32 skip = 0);
     bool fix_deadlock();
 
     u8 sim_time() { return (u8)(sit().simulation_step - orig().simulation_step); }
@@ -359,6 +598,22 @@ public:
     }
 };
 
+extern template struct Strategy<16>;
+extern template struct Strategy<20>;
+extern template struct Strategy<28>;
+extern template struct Strategy_store<16>;
+extern template struct Strategy_store<20>;
+extern template struct Strategy_store<28>;
+extern template class Situation<16>;
+extern template class Situation<20>;
+extern template class Situation<28>;
+extern template struct Crafting_planner<16>;
+extern template struct Crafting_planner<20>;
+extern template struct Crafting_planner<28>;
+extern template class Simulation_state<16>;
+extern template class Simulation_state<20>;
+extern template class Simulation_state<28>;
+
 template <typename Range, typename T = std::remove_reference_t<decltype(*std::declval<Range>().begin())>,
     typename Id = decltype(std::declval<T>().id)>
 T& get_by_id(Range& arr, Id id) {
@@ -2,6 +2,7 @@
 #pragma once
 
 
+#include "array.hpp"
 #include "buffer.hpp"
 
 namespace jup {
@@ -16,6 +17,17 @@ struct Socket_context {
 	~Socket_context();
 };
 
+/**
+ * Options of a connection, applied when a Socket is initialized. Buffer sizes of 0 keep the
+ * default of the system.
+ */
+struct Socket_options {
+    // Send small messages immediately, instead of waiting for more data (TCP_NODELAY)
+    bool no_delay = true;
+    int recv_buffer_size = 0; // SO_RCVBUF
+    int send_buffer_size = 0; // SO_SNDBUF
+};
+
 /**
  * Abstract a single Socket. This is owning, meaning that the Socket is created
  * on construction and released on destruction. Also, copy semantics are not
@@ -34,10 +46,12 @@ struct Socket {
 	 *
 	 * address and port MUST BE zero-terminated strings.
 	 */
-	Socket(Buffer_view /* c_str */ address, Buffer_view /* c_str */ port) {
-        init(address, port);
+	Socket(Buffer_view /* c_str */ address, Buffer_view /* c_str */ port,
+            Socket_options const& options = {}) {
+        init(address, port, options);
     }
-    void init(Buffer_view /* c_str */ address, Buffer_view /* c_str */ port);
+    void init(Buffer_view /* c_str */ address, Buffer_view /* c_str */ port,
+            Socket_options const& options = {});
 
 	
 	/**
@@ -56,7 +70,7 @@ struct Socket {
 	operator bool() const { return initialized and not err; }
 
 	/**
-	 * Send data over the socket.
+	 * Send data over the socket. Blocks until all of it has been handed to the system.
 	 */
 	void send(Buffer_view data);
 
@@ -66,18 +80,139 @@ struct Socket {
 	 */
 	int recv(Buffer* into);
 
+	/**
+	 * Like recv, but reads only the data that is available. This calls the underlying recv
+	 * exactly once, so it does not block if the socket is readable (see wait_readable).
+	 */
+	int recv_available(Buffer* into);
+
     /**
      * Returns an integer uniquely identifying the socket. No other guarantees are made.
      */
     int get_id() const;
 
+    /**
+     * The data received but not consumed yet, which starts at recv_begin. get_next_message reads
+     * into this and parses the messages directly from here. The bytes before recv_begin belong to
+     * the last message, they are reclaimed before the next read.
+     */
+    Buffer recv_buffer;
+    int recv_begin = 0;
+
+    /**
+     * send_message writes outgoing messages into this, so that they can be sent in one piece
+     * without allocating.
+     */
+    Buffer send_buffer;
     
 	bool initialized = false;
     bool err = false;
 	
 	// Only guaranteed to contain valid data when the socket is valid is set,
 	// else UNDEFINED. The contents are implementation defined.
-	char data[16] = {0};
+	alignas(u64) char data[16] = {0};
+};
+
+/**
+ * Block until at least one of the sockets has data to read, then set the corresponding entries of
+ * readable. All sockets must be valid. Returns the number of readable sockets, or -1 on error.
+ */
+int wait_readable(Socket* const* sockets, int count, bool* readable);
+
+/**
+ * Sends the send_buffer of many sockets at once. On Linux, the sends of a batch are submitted with a
+ * single system call through io_uring, if the kernel supports it. Otherwise, and on win32, they are
+ * sent one after the other.
+ */
+struct Socket_sender {
+    Socket_sender() {}
+    ~Socket_sender() { close(); }
+
+    // Prepare for batches of up to capacity sockets. Larger batches are split.
+    void init(int capacity);
+    void close();
+
+    /**
+     * Send the send_buffer of each of the sockets, like Socket::send. Blocks until all of the data
+     * has been handed to the system. Sockets where that fails become invalid. If waiting for a batch
+     * fails, the sends the kernel still holds are left to it and batching stops. Their sockets stay
+     * valid and get a new send_buffer, the next call waits for those sends first.
+     */
+    void send_buffers(Socket* const* sockets, int count);
+
+    explicit operator bool() const { return initialized; }
+
+    bool initialized = false;
+    // Whether the sends are actually submitted together
+    bool batched = false;
+
+    // Implementation defined
+    void* impl = nullptr;
+};
+
+/**
+ * A set of sockets that is registered once and can then be waited on repeatedly, unlike
+ * wait_readable, which passes all of them on each call. On POSIX this is an epoll instance. Each
+ * socket is added with a tag, which is what wait reports. The sockets must stay valid while they
+ * are registered, but they may be moved.
+ */
+struct Socket_poller {
+    Socket_poller() {}
+    ~Socket_poller() { close(); }
+
+    void init();
+    void close();
+
+    void add(Socket const& sock, int tag);
+    void remove(Socket const& sock);
+
+    /**
+     * Block until at least one of the sockets has data to read, or timeout milliseconds have
+     * passed (-1 waits indefinitely). Writes the tags of up to max readable sockets into tags and
+     * returns their number, or -1 on error.
+     */
+    int wait(int* tags, int max, int timeout = -1);
+
+    explicit operator bool() const { return initialized; }
+
+    bool initialized = false;
+
+    // Implementation defined. The POSIX backend uses handle, the win32 backend the arrays.
+    int handle = -1;
+    Array<u64> handles;
+    Array<int> tags;
+};
+
+/**
+ * Accepts connections on the loopback interface, to play the part of the server locally, for
+ * example in benchmarks.
+ */
+struct Socket_listener {
+    Socket_listener() {}
+    ~Socket_listener() { close(); }
+
+    /**
+     * Start listening on the port, which must be zero-terminated. For "0", the system chooses a
+     * free port, see port(). Errors are printed as warnings, the listener is invalid afterwards.
+     */
+    void init(Buffer_view /* c_str */ port);
+    void close();
+
+    /**
+     * Block until a client connects and initialize into with the connection. Returns whether that
+     * succeeded.
+     */
+    bool accept(Socket* into, Socket_options const& options = {});
+
+    // The port that is listened on
+    int port() const;
+
+    explicit operator bool() const { return initialized; }
+
+    bool initialized = false;
+
+    // The listening socket, implementation defined
+    u64 handle = 0;
 };
 	
 } /* end of namespace jup */
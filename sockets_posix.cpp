@@ -0,0 +1,687 @@
+
+#include "sockets.hpp"
+
+#include <cerrno>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+namespace jup {
+
+Socket_context::Socket_context() {
+	// Writing to a closed connection should fail with EPIPE instead of killing the program. send
+	// already passes MSG_NOSIGNAL, this covers everything else.
+	std::signal(SIGPIPE, SIG_IGN);
+}
+Socket_context::~Socket_context() {}
+
+struct Socket_posix_data {
+    int fd;
+    int id;
+};
+
+static int socket_id_counter = 0;
+
+/**
+ * Helper, does some casting and asserting
+ */
+static Socket_posix_data& get_sock(char* data) {
+	static_assert(sizeof(Socket().data) >= sizeof(Socket_posix_data),
+				  "sock.data is not big enough");
+	return *(Socket_posix_data*)data;
+}
+
+static void print_errno(char const* what) {
+	jerr << "Warning: " << what << " failed: " << std::strerror(errno) << '\n';
+}
+
+/**
+ * Set the buffer sizes of the options. These have to be set before connecting, as the window
+ * scaling of TCP is negotiated during the handshake.
+ */
+static void set_buffer_sizes(int fd, Socket_options const& options) {
+	if (options.recv_buffer_size > 0) {
+		int value = options.recv_buffer_size;
+		if (setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &value, sizeof(value))) {
+			print_errno("setsockopt(SO_RCVBUF)");
+		}
+	}
+	if (options.send_buffer_size > 0) {
+		int value = options.send_buffer_size;
+		if (setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &value, sizeof(value))) {
+			print_errno("setsockopt(SO_SNDBUF)");
+		}
+	}
+}
+
+/**
+ * Set the options that apply to an established connection, and make the socket non-blocking. Only
+ * the latter is required for the socket to work.
+ */
+static bool set_connected_options(int fd, Socket_options const& options) {
+	int value = options.no_delay;
+	if (setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &value, sizeof(value))) {
+		print_errno("setsockopt(TCP_NODELAY)");
+	}
+
+	int flags = fcntl(fd, F_GETFL, 0);
+	if (flags == -1 or fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1) {
+		print_errno("fcntl(O_NONBLOCK)");
+		return false;
+	}
+	return true;
+}
+
+/**
+ * Block until the socket is ready for events (POLLIN or POLLOUT). Returns false on error.
+ */
+static bool wait_for(int fd, short events) {
+	pollfd p {fd, events, 0};
+	while (poll(&p, 1, -1) == -1) {
+		if (errno == EINTR) continue;
+		print_errno("poll");
+		return false;
+	}
+	return true;
+}
+
+// see header
+void Socket::init(Buffer_view address, Buffer_view port, Socket_options const& options) {
+    addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_protocol = IPPROTO_TCP;
+
+    addrinfo* result = nullptr;
+    auto code = getaddrinfo(address.c_str(), port.c_str(), &hints, &result);
+    if (code) {
+		jerr << "Warning: getaddrinfo failed: " << gai_strerror(code) << '\n';
+		return;
+	}
+
+	addrinfo* ptr = result;
+	while (ptr) {
+		int sock = socket(ptr->ai_family, ptr->ai_socktype | SOCK_CLOEXEC, ptr->ai_protocol);
+		if (sock == -1) {
+			print_errno("socket()");
+		} else {
+			set_buffer_sizes(sock, options);
+			// Connect while still blocking, there is nothing else to do in the meantime
+			if (connect(sock, ptr->ai_addr, ptr->ai_addrlen) == -1) {
+				::close(sock);
+				jerr << "Warning: Unable to connect to server!\n";
+			} else if (not set_connected_options(sock, options)) {
+				::close(sock);
+			} else {
+				get_sock(data) = {sock, ++socket_id_counter};
+				break;
+			}
+		}
+
+		ptr = ptr->ai_next;
+	}
+
+	freeaddrinfo(result);
+	if (not ptr) return;
+
+	initialized = true;
+    err = false;
+    recv_buffer.reset();
+    recv_begin = 0;
+}
+
+// see header
+void Socket::close() {
+	if (!initialized) return;
+	::close(get_sock(data).fd);
+	initialized = false;
+}
+
+// see header
+void Socket::send(Buffer_view buf) {
+	assert(initialized);
+
+	// The socket is non-blocking, so the data may be accepted in pieces
+	int fd = get_sock(data).fd;
+	char const* pos = buf.data();
+	int left = buf.size();
+	while (left > 0) {
+		auto result = ::send(fd, pos, left, MSG_NOSIGNAL);
+		if (result == -1) {
+			if (errno == EINTR) continue;
+			if ((errno == EAGAIN or errno == EWOULDBLOCK) and wait_for(fd, POLLOUT)) continue;
+			print_errno("send");
+			err = true;
+			close();
+			return;
+		}
+		pos += result;
+		left -= result;
+	}
+}
+
+// see header
+int Socket::recv(Buffer* into) {
+	assert(into);
+
+	int total_count = 0;
+	while(true) {
+		into->reserve_space(256);
+		int space = into->space();
+		int result = recv_available(into);
+		total_count += result;
+		if (not initialized) {
+			return total_count;
+		} else if (result == space) {
+			continue;
+		} else if (total_count) {
+			return total_count;
+		} else if (not wait_for(get_sock(data).fd, POLLIN)) {
+			err = true;
+			close();
+			return 0;
+		}
+	}
+}
+
+// see header
+int Socket::recv_available(Buffer* into) {
+	assert(into);
+	assert(initialized);
+
+	into->reserve_space(256);
+	ssize_t result;
+	do {
+		result = ::recv(get_sock(data).fd, into->end(), into->space(), 0);
+	} while (result == -1 and errno == EINTR);
+
+	if (result == -1) {
+		if (errno == EAGAIN or errno == EWOULDBLOCK) {
+			// Not readable after all, this is not an error
+			return 0;
+		}
+
+		// See sockets_win32.cpp
+		if (program_closing) {
+			std::this_thread::sleep_for(std::chrono::seconds(1)); assert(false);
+		}
+
+		print_errno("recv");
+		close();
+		err = true;
+		return 0;
+	} else if (result == 0) {
+		jerr << "Warning: recv returned 0\n";
+		close();
+		return 0;
+	}
+	assert(result <= into->space());
+	into->addsize(result);
+	return result;
+}
+
+// see header
+int wait_readable(Socket* const* sockets, int count, bool* readable) {
+	assert(sockets and readable);
+	assert(0 < count);
+
+	// Only a few dozen sockets at most, so poll is as fast as registering them with epoll
+	static thread_local Array<pollfd> fds;
+	fds.resize(count);
+	for (int i = 0; i < count; ++i) {
+		assert(sockets[i] and sockets[i]->initialized);
+		fds[i] = {get_sock(sockets[i]->data).fd, POLLIN, 0};
+	}
+
+	int result;
+	do {
+		result = poll(fds.data(), count, -1);
+	} while (result == -1 and errno == EINTR);
+	if (result == -1) {
+		print_errno("poll");
+		return -1;
+	}
+
+	// Errors and hangups count as readable, recv then reports them
+	for (int i = 0; i < count; ++i) {
+		readable[i] = fds[i].revents != 0;
+	}
+	return result;
+}
+
+int Socket::get_id() const {
+    return get_sock(const_cast<char*>(data)).id;
+}
+
+// see header
+void Socket_poller::init() {
+	assert(not initialized);
+	handle = epoll_create1(EPOLL_CLOEXEC);
+	if (handle == -1) {
+		print_errno("epoll_create1");
+		return;
+	}
+	initialized = true;
+}
+
+// see header
+void Socket_poller::close() {
+	if (not initialized) return;
+	::close(handle);
+	handle = -1;
+	initialized = false;
+}
+
+// see header
+void Socket_poller::add(Socket const& sock, int tag) {
+	assert(initialized and sock.initialized);
+	epoll_event event = {};
+	event.events = EPOLLIN;
+	event.data.u32 = tag;
+	assert_errno(epoll_ctl(handle, EPOLL_CTL_ADD, get_sock(const_cast<char*>(sock.data)).fd, &event) == 0);
+}
+
+// see header
+void Socket_poller::remove(Socket const& sock) {
+	assert(initialized and sock.initialized);
+	assert_errno(epoll_ctl(handle, EPOLL_CTL_DEL, get_sock(const_cast<char*>(sock.data)).fd, nullptr) == 0);
+}
+
+// see header
+int Socket_poller::wait(int* tags_out, int max, int timeout) {
+	assert(initialized and tags_out and max > 0);
+
+	constexpr int events_max = 64;
+	epoll_event events[events_max];
+	int result;
+	do {
+		result = epoll_wait(handle, events, std::min(max, events_max), timeout);
+	} while (result == -1 and errno == EINTR);
+	if (result == -1) {
+		print_errno("epoll_wait");
+		return -1;
+	}
+
+	for (int i = 0; i < result; ++i) {
+		tags_out[i] = events[i].data.u32;
+	}
+	return result;
+}
+
+#ifdef __linux__
+
+/**
+ * The rings shared with the kernel, see io_uring_setup(2). The system calls are used directly, as
+ * only sends are needed.
+ */
+struct Uring {
+	int fd = -1;
+	unsigned entries;
+	unsigned* sq_head;
+	unsigned* sq_tail;
+	unsigned* sq_mask;
+	unsigned* sq_array;
+	unsigned* cq_head;
+	unsigned* cq_tail;
+	unsigned* cq_mask;
+	io_uring_sqe* sqes;
+	io_uring_cqe* cqes;
+
+	void* sq_ring = MAP_FAILED;
+	void* cq_ring = MAP_FAILED;
+	void* sqes_ring = MAP_FAILED;
+	size_t sq_size, cq_size, sqes_size;
+
+	// The result of each send of the current batch
+	Array<int> results;
+
+	// After uring_send gave up on the ring, the send buffers of the sends still in the kernel, by
+	// their index in the batch. They are kept until the sends complete, see uring_settle.
+	std::vector<Buffer> in_flight;
+	int in_flight_count = 0;
+};
+
+static void uring_close(Uring* ring) {
+	if (ring->sqes_ring != MAP_FAILED) munmap(ring->sqes_ring, ring->sqes_size);
+	if (ring->cq_ring != MAP_FAILED and ring->cq_ring != ring->sq_ring) {
+		munmap(ring->cq_ring, ring->cq_size);
+	}
+	if (ring->sq_ring != MAP_FAILED) munmap(ring->sq_ring, ring->sq_size);
+	if (ring->fd != -1) ::close(ring->fd);
+}
+
+static bool uring_init(Uring* ring, int entries) {
+	io_uring_params params = {};
+	ring->fd = syscall(__NR_io_uring_setup, entries, &params);
+	if (ring->fd == -1) {
+		print_errno("io_uring_setup");
+		return false;
+	}
+	ring->entries = params.sq_entries;
+
+	ring->sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	ring->cq_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+	bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+	if (single_mmap) {
+		ring->sq_size = ring->cq_size = std::max(ring->sq_size, ring->cq_size);
+	}
+	ring->sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+
+	auto map = [ring](size_t size, u64 offset) {
+		return mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, offset);
+	};
+	ring->sq_ring = map(ring->sq_size, IORING_OFF_SQ_RING);
+	if (ring->sq_ring == MAP_FAILED) {
+		print_errno("mmap");
+		return false;
+	}
+	ring->cq_ring = single_mmap ? ring->sq_ring : map(ring->cq_size, IORING_OFF_CQ_RING);
+	ring->sqes_ring = map(ring->sqes_size, IORING_OFF_SQES);
+	if (ring->cq_ring == MAP_FAILED or ring->sqes_ring == MAP_FAILED) {
+		print_errno("mmap");
+		return false;
+	}
+
+	char* sq = (char*)ring->sq_ring;
+	char* cq = (char*)ring->cq_ring;
+	ring->sq_head  = (unsigned*)(sq + params.sq_off.head);
+	ring->sq_tail  = (unsigned*)(sq + params.sq_off.tail);
+	ring->sq_mask  = (unsigned*)(sq + params.sq_off.ring_mask);
+	ring->sq_array = (unsigned*)(sq + params.sq_off.array);
+	ring->cq_head  = (unsigned*)(cq + params.cq_off.head);
+	ring->cq_tail  = (unsigned*)(cq + params.cq_off.tail);
+	ring->cq_mask  = (unsigned*)(cq + params.cq_off.ring_mask);
+	ring->cqes = (io_uring_cqe*)(cq + params.cq_off.cqes);
+	ring->sqes = (io_uring_sqe*)ring->sqes_ring;
+
+	ring->results.resize(ring->entries);
+	ring->in_flight.resize(ring->entries);
+	return true;
+}
+
+/**
+ * Move the completions that are available into ring->results. Returns their number.
+ */
+static int uring_reap(Uring* ring) {
+	unsigned head = *ring->cq_head;
+	unsigned cq_tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+	int count = 0;
+	for (; head != cq_tail; ++head, ++count) {
+		io_uring_cqe const& cqe = ring->cqes[head & *ring->cq_mask];
+		ring->results[cqe.user_data] = cqe.res;
+	}
+	__atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+	return count;
+}
+
+// Marks the sends of a batch that have not completed yet, see uring_send
+constexpr int uring_pending = std::numeric_limits<int>::min();
+
+/**
+ * Wait for the sends in ring->in_flight and release their buffers. If waiting fails, the ones that
+ * have not completed are kept.
+ */
+static void uring_settle(Uring* ring) {
+	if (ring->in_flight_count == 0) return;
+	int result;
+	do {
+		result = syscall(__NR_io_uring_enter, ring->fd, 0, ring->in_flight_count,
+			IORING_ENTER_GETEVENTS, nullptr, 0);
+	} while (result == -1 and errno == EINTR);
+	if (result == -1) print_errno("io_uring_enter");
+	uring_reap(ring);
+
+	for (int i = 0; i < (int)ring->in_flight.size(); ++i) {
+		Buffer& buffer = ring->in_flight[i];
+		int result = ring->results[i];
+		if (buffer.size() == 0 or result == uring_pending) continue;
+		if (result < 0) {
+			errno = -result;
+			print_errno("send");
+		} else if (result < buffer.size()) {
+			jerr << "Warning: The kernel sent only " << result << " of " << buffer.size()
+				 << " bytes of a message it held on to\n";
+		}
+		buffer.free();
+		--ring->in_flight_count;
+	}
+}
+
+/**
+ * Submit a send of the send_buffer of each of the sockets with a single system call and wait for
+ * all of them to complete. Afterwards, ring->results contains the number of bytes sent or the
+ * negative error code of each. Sends the kernel did not take have -ECANCELED, they can be sent
+ * normally. Returns false if the ring cannot be used anymore, as waiting for the sends failed. Then
+ * the sends still in the kernel keep uring_pending, they may or may not happen later.
+ */
+static bool uring_send(Uring* ring, Socket* const* sockets, int count) {
+	assert(0 < count and count <= (int)ring->entries);
+
+	// Only this thread writes the tail of the submission queue
+	unsigned tail = *ring->sq_tail;
+	unsigned mask = *ring->sq_mask;
+	for (int i = 0; i < count; ++i) {
+		assert(sockets[i] and sockets[i]->initialized);
+		Buffer const& buffer = sockets[i]->send_buffer;
+		unsigned index = tail & mask;
+		io_uring_sqe& sqe = ring->sqes[index];
+		std::memset(&sqe, 0, sizeof(sqe));
+		sqe.opcode = IORING_OP_SEND;
+		sqe.fd = get_sock(sockets[i]->data).fd;
+		sqe.addr = (u64)buffer.data();
+		sqe.len = buffer.size();
+		// MSG_WAITALL makes the kernel finish a partial send itself, so a send it holds on to after
+		// a failed wait does not end with only a part of the message on the wire
+		sqe.msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+		sqe.user_data = i;
+		ring->sq_array[index] = index;
+		ring->results[i] = uring_pending;
+		++tail;
+	}
+	__atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+
+	int submitted = count;
+	int completed = 0;
+	while (completed < submitted) {
+		unsigned pending = tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+		int result = syscall(__NR_io_uring_enter, ring->fd, pending, submitted - completed,
+			IORING_ENTER_GETEVENTS, nullptr, 0);
+		int error = result == -1 ? errno : 0;
+		int reaped = uring_reap(ring);
+		completed += reaped;
+		if (error == 0 or error == EINTR) continue;
+
+		errno = error;
+		print_errno("io_uring_enter");
+		// The kernel takes the entries in order, so the ones it has not seen are at the end. They
+		// are taken back.
+		unsigned unseen = tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+		if (unseen) {
+			tail -= unseen;
+			__atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+			submitted -= unseen;
+			for (int i = submitted; i < count; ++i) {
+				ring->results[i] = -ECANCELED;
+			}
+		} else if (reaped == 0) {
+			return false;
+		}
+	}
+	return true;
+}
+
+#endif
+
+// see header
+void Socket_sender::init(int capacity) {
+	assert(not initialized and capacity > 0);
+	initialized = true;
+
+#ifdef __linux__
+	auto* ring = new Uring;
+	if (uring_init(ring, capacity)) {
+		impl = ring;
+		batched = true;
+	} else {
+		jerr << "Warning: io_uring is not available, the sockets are sent one after the other.\n";
+		uring_close(ring);
+		delete ring;
+	}
+#endif
+}
+
+// see header
+void Socket_sender::close() {
+	if (not initialized) return;
+#ifdef __linux__
+	if (impl) {
+		// The buffers of sends the kernel may still do must outlive the ring, closing it cancels
+		// them
+		uring_settle((Uring*)impl);
+		uring_close((Uring*)impl);
+		delete (Uring*)impl;
+		impl = nullptr;
+	}
+#endif
+	batched = false;
+	initialized = false;
+}
+
+// see header
+void Socket_sender::send_buffers(Socket* const* sockets, int count) {
+	assert(initialized and sockets);
+
+	int first = 0;
+#ifdef __linux__
+	if (impl) {
+		// Sends the kernel still holds have to finish before anything else goes out on their sockets
+		uring_settle((Uring*)impl);
+	}
+	for (; batched and first < count;) {
+		auto* ring = (Uring*)impl;
+		int size = std::min(count - first, (int)ring->entries);
+		if (not uring_send(ring, sockets + first, size)) {
+			jerr << "Warning: Sending with io_uring failed, the sockets are sent one after the "
+				 << "other from now on.\n";
+			batched = false;
+		}
+
+		for (int i = 0; i < size; ++i) {
+			Socket& sock = *sockets[first + i];
+			Buffer const& buffer = sock.send_buffer;
+			int result = ring->results[i];
+			if (result == uring_pending) {
+				// The kernel still has the send, it may happen or not. The socket stays open and
+				// gets a new buffer, as the kernel reads from this one until it is done.
+				std::swap(ring->in_flight[i], sock.send_buffer);
+				++ring->in_flight_count;
+			} else if (result >= 0) {
+				// Send the rest, if the socket did not take everything
+				if (result < buffer.size()) {
+					sock.send({buffer.data() + result, buffer.size() - result});
+				}
+			} else if (result == -EAGAIN or result == -EINTR or result == -ECANCELED) {
+				sock.send(buffer);
+			} else if (result == -EINVAL or result == -EOPNOTSUPP) {
+				// The kernel does not support IORING_OP_SEND
+				batched = false;
+				sock.send(buffer);
+			} else {
+				errno = -result;
+				print_errno("send");
+				sock.err = true;
+				sock.close();
+			}
+		}
+		first += size;
+	}
+#endif
+
+	for (int i = first; i < count; ++i) {
+		sockets[i]->send(sockets[i]->send_buffer);
+	}
+}
+
+// see header
+void Socket_listener::init(Buffer_view port) {
+	assert(not initialized);
+
+	int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, IPPROTO_TCP);
+	if (fd == -1) {
+		print_errno("socket()");
+		return;
+	}
+	int value = 1;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &value, sizeof(value));
+
+	sockaddr_in addr = {};
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = htons(std::atoi(port.c_str()));
+	if (bind(fd, (sockaddr*)&addr, sizeof(addr)) == -1 or listen(fd, SOMAXCONN) == -1) {
+		print_errno("bind/listen");
+		::close(fd);
+		return;
+	}
+
+	handle = fd;
+	initialized = true;
+}
+
+// see header
+void Socket_listener::close() {
+	if (not initialized) return;
+	::close((int)handle);
+	initialized = false;
+}
+
+// see header
+bool Socket_listener::accept(Socket* into, Socket_options const& options) {
+	assert(initialized and into);
+	into->close();
+
+	int fd;
+	do {
+		fd = accept4((int)handle, nullptr, nullptr, SOCK_CLOEXEC);
+	} while (fd == -1 and errno == EINTR);
+	if (fd == -1) {
+		print_errno("accept");
+		return false;
+	}
+
+	// The handshake is already done, so the buffer sizes only apply from here on
+	set_buffer_sizes(fd, options);
+	if (not set_connected_options(fd, options)) {
+		::close(fd);
+		return false;
+	}
+
+	get_sock(into->data) = {fd, ++socket_id_counter};
+	into->initialized = true;
+	into->err = false;
+	into->recv_buffer.reset();
+	into->recv_begin = 0;
+	return true;
+}
+
+// see header
+int Socket_listener::port() const {
+	assert(initialized);
+	sockaddr_in addr = {};
+	socklen_t size = sizeof(addr);
+	assert_errno(getsockname((int)handle, (sockaddr*)&addr, &size) == 0);
+	return ntohs(addr.sin_port);
+}
+
+} /* end of namespace jup */
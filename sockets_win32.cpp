@@ -28,8 +28,32 @@ Socket_win32_data& get_sock(char* data) {
 	return *(Socket_win32_data*)data;
 }
 
+/**
+ * Apply the options to the socket. The buffer sizes should be set before connecting, as the window
+ * scaling of TCP is negotiated during the handshake. Failures are only printed, the socket works
+ * regardless.
+ */
+static void set_options(SOCKET sock, Socket_options const& options) {
+	BOOL no_delay = options.no_delay;
+	if (setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, (char const*)&no_delay, sizeof(no_delay))) {
+		jerr << "Warning: setsockopt(TCP_NODELAY) failed: " << WSAGetLastError() << '\n';
+	}
+	if (options.recv_buffer_size > 0) {
+		int value = options.recv_buffer_size;
+		if (setsockopt(sock, SOL_SOCKET, SO_RCVBUF, (char const*)&value, sizeof(value))) {
+			jerr << "Warning: setsockopt(SO_RCVBUF) failed: " << WSAGetLastError() << '\n';
+		}
+	}
+	if (options.send_buffer_size > 0) {
+		int value = options.send_buffer_size;
+		if (setsockopt(sock, SOL_SOCKET, SO_SNDBUF, (char const*)&value, sizeof(value))) {
+			jerr << "Warning: setsockopt(SO_SNDBUF) failed: " << WSAGetLastError() << '\n';
+		}
+	}
+}
+
 // see header
-void Socket::init(Buffer_view address, Buffer_view port) {
+void Socket::init(Buffer_view address, Buffer_view port, Socket_options const& options) {
     addrinfo hints = {};
     hints.ai_family = AF_UNSPEC;
     hints.ai_socktype = SOCK_STREAM;
@@ -45,6 +69,7 @@ void Socket::init(Buffer_view address, Buffer_view port) {
 		if (sock == INVALID_SOCKET) {
 			jerr << "Warning: Error at socket(): " << WSAGetLastError() << '\n';
 		} else {
+			set_options(sock, options);
 			auto code = connect(sock, ptr->ai_addr, (int)ptr->ai_addrlen);
 			if (code == SOCKET_ERROR) {
 				closesocket(sock);
@@ -63,6 +88,8 @@ void Socket::init(Buffer_view address, Buffer_view port) {
 
 	initialized = true;
     err = false;
+    recv_buffer.reset();
+    recv_begin = 0;
 }
 
 // see header
@@ -87,46 +114,216 @@ void Socket::send(Buffer_view buf) {
 // see header
 int Socket::recv(Buffer* into) {
 	assert(into);
-	assert(initialized);
 
 	int total_count = 0;
 	while(true) {
 		into->reserve_space(256);
-		auto result = ::recv(get_sock(data).sock, into->end(), into->space(), 0);
-		
-		if (result < 0) {
-            // This is dirty. When the program is closing down, there could be
-            // an error here due to the server being killed. This is a sleep we
-            // should not wake up from.
-            if (program_closing) {
-                sleep(1000); assert(false);
-            }
-            
-			jerr << "Warning: recv failed: " << WSAGetLastError() << '\n';
-			close();
-            err = true;
-			return total_count;
-		} else if (result == 0) {
-            jerr << "Warning: recv returned 0\n";
-			close();
+		int space = into->space();
+		int result = recv_available(into);
+		total_count += result;
+		if (result < space) {
 			return total_count;
-        } else if (result < into->space()) {
-			into->addsize(result);
-			total_count += result;
-			return total_count;
-		} else if (result == into->space()) {
-			into->addsize(result);
-			total_count += result;
-		} else {
-			assert(false);
 		}
 	}
 }
 
+// see header
+int Socket::recv_available(Buffer* into) {
+	assert(into);
+	assert(initialized);
+
+	into->reserve_space(256);
+	auto result = ::recv(get_sock(data).sock, into->end(), into->space(), 0);
+
+	if (result < 0) {
+		// This is dirty. When the program is closing down, there could be
+		// an error here due to the server being killed. This is a sleep we
+		// should not wake up from.
+		if (program_closing) {
+			sleep(1000); assert(false);
+		}
+
+		jerr << "Warning: recv failed: " << WSAGetLastError() << '\n';
+		close();
+		err = true;
+		return 0;
+	} else if (result == 0) {
+		jerr << "Warning: recv returned 0\n";
+		close();
+		return 0;
+	}
+	assert(result <= into->space());
+	into->addsize(result);
+	return result;
+}
+
+// see header
+int wait_readable(Socket* const* sockets, int count, bool* readable) {
+	assert(sockets and readable);
+	assert(0 < count and count <= FD_SETSIZE);
+
+	fd_set set;
+	FD_ZERO(&set);
+	for (int i = 0; i < count; ++i) {
+		assert(sockets[i] and sockets[i]->initialized);
+		FD_SET(get_sock(sockets[i]->data).sock, &set);
+	}
+
+	// The first argument is ignored by winsock
+	int result = select(0, &set, nullptr, nullptr, nullptr);
+	if (result == SOCKET_ERROR) {
+		jerr << "Warning: select failed: " << WSAGetLastError() << '\n';
+		return -1;
+	}
+
+	for (int i = 0; i < count; ++i) {
+		readable[i] = FD_ISSET(get_sock(sockets[i]->data).sock, &set);
+	}
+	return result;
+}
+
 int Socket::get_id() const {
     return get_sock(const_cast<char*>(data)).id;
 }
 
+// see header
+void Socket_poller::init() {
+	assert(not initialized);
+	handles.reset();
+	tags.reset();
+	initialized = true;
+}
+
+// see header
+void Socket_poller::close() {
+	initialized = false;
+}
+
+// see header
+void Socket_poller::add(Socket const& sock, int tag) {
+	assert(initialized and sock.initialized);
+	assert(handles.size() < FD_SETSIZE);
+	handles.push_back(get_sock(const_cast<char*>(sock.data)).sock);
+	tags.push_back(tag);
+}
+
+// see header
+void Socket_poller::remove(Socket const& sock) {
+	assert(initialized and sock.initialized);
+	int i = handles.index(get_sock(const_cast<char*>(sock.data)).sock);
+	assert(i != -1);
+	handles[i] = handles.back();
+	tags[i] = tags.back();
+	handles.addsize(-1);
+	tags.addsize(-1);
+}
+
+// see header
+int Socket_poller::wait(int* tags_out, int max, int timeout) {
+	assert(initialized and tags_out and max > 0);
+
+	// Winsock has no persistent registration, so this is just select
+	fd_set set;
+	FD_ZERO(&set);
+	for (u64 i: handles) {
+		FD_SET((SOCKET)i, &set);
+	}
+	timeval time {timeout / 1000, timeout % 1000 * 1000};
+	int result = select(0, &set, nullptr, nullptr, timeout == -1 ? nullptr : &time);
+	if (result == SOCKET_ERROR) {
+		jerr << "Warning: select failed: " << WSAGetLastError() << '\n';
+		return -1;
+	}
+
+	int count = 0;
+	for (int i = 0; i < handles.size() and count < max; ++i) {
+		if (FD_ISSET((SOCKET)handles[i], &set)) {
+			tags_out[count++] = tags[i];
+		}
+	}
+	return count;
+}
+
+// see header
+void Socket_sender::init(int capacity) {
+	assert(not initialized and capacity > 0);
+	initialized = true;
+}
+
+// see header
+void Socket_sender::close() {
+	initialized = false;
+}
+
+// see header
+void Socket_sender::send_buffers(Socket* const* sockets, int count) {
+	assert(initialized and sockets);
+	for (int i = 0; i < count; ++i) {
+		sockets[i]->send(sockets[i]->send_buffer);
+	}
+}
+
+// see header
+void Socket_listener::init(Buffer_view port) {
+	assert(not initialized);
+
+	SOCKET sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if (sock == INVALID_SOCKET) {
+		jerr << "Warning: Error at socket(): " << WSAGetLastError() << '\n';
+		return;
+	}
+
+	sockaddr_in addr = {};
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = htons(std::atoi(port.c_str()));
+	if (bind(sock, (sockaddr*)&addr, sizeof(addr)) == SOCKET_ERROR
+			or listen(sock, SOMAXCONN) == SOCKET_ERROR) {
+		jerr << "Warning: bind/listen failed: " << WSAGetLastError() << '\n';
+		closesocket(sock);
+		return;
+	}
+
+	handle = sock;
+	initialized = true;
+}
+
+// see header
+void Socket_listener::close() {
+	if (not initialized) return;
+	closesocket((SOCKET)handle);
+	initialized = false;
+}
+
+// see header
+bool Socket_listener::accept(Socket* into, Socket_options const& options) {
+	assert(initialized and into);
+	into->close();
+
+	SOCKET sock = ::accept((SOCKET)handle, nullptr, nullptr);
+	if (sock == INVALID_SOCKET) {
+		jerr << "Warning: accept failed: " << WSAGetLastError() << '\n';
+		return false;
+	}
+	set_options(sock, options);
+
+	get_sock(into->data) = {sock, ++socket_id_counter};
+	into->initialized = true;
+	into->err = false;
+	into->recv_buffer.reset();
+	into->recv_begin = 0;
+	return true;
+}
+
+// see header
+int Socket_listener::port() const {
+	assert(initialized);
+	sockaddr_in addr = {};
+	int size = sizeof(addr);
+	assert(getsockname((SOCKET)handle, (sockaddr*)&addr, &size) == 0);
+	return ntohs(addr.sin_port);
+}
+
 } /* end of namespace jup */
     
 int socketsMain() {
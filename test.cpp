@@ -67,6 +67,342 @@ void test_flat_diff() {
     jdbg < lst ,0;
 }
 
+struct Test_node {
+    u16 id;
+    Flat_array<u8> sub;
+};
+
+/**
+ * Build an array of nodes, each containing another array, followed by a further array at the end
+ * of the buffer. The headers of both outer arrays are at the returned offset.
+ */
+static int test_flat_diff_build(Buffer* buf, Diff_flat_arrays* diff, Rng rng) {
+    buf->reset();
+    buf->reserve(4096);
+    buf->append0(3);
+    int offset = buf->size();
+    auto& lst  = buf->emplace_back<Flat_array<Test_node>>();
+    auto& tail = buf->emplace_back<Flat_array<u8>>();
+    lst.init(buf);
+    int n = rng.gen_uni(8) + 1;
+    for (int i = 0; i < n; ++i) {
+        lst.push_back(Test_node {(u16)i, {}}, buf);
+    }
+    for (auto& i: lst) {
+        i.sub.init(buf);
+        int m = rng.gen_uni(5);
+        for (int j = 0; j < m; ++j) i.sub.push_back((u8)rng.gen_uni(256), buf);
+    }
+    tail.init(buf);
+    tail.push_back(1, buf);
+
+    diff->init(buf);
+    diff->register_arr(lst);
+    for (auto& i: lst) diff->register_arr(i.sub);
+    diff->register_arr(tail);
+    diff->register_commit();
+    return offset;
+}
+
+void test_flat_diff_batched() {
+    enum Op_type: u8 {
+        ADD_NODE, REMOVE_NODE, ADD_SUB, REMOVE_SUB, ADD_TAIL, REMOVE_TAIL, OP_TYPE_COUNT
+    };
+    struct Op {
+        u8 type, node, value;
+    };
+    
+    Rng rng;
+    Buffer buf_each, buf_batch;
+    Diff_flat_arrays diff_each, diff_batch;
+    Array<Op> ops;
+    
+    for (int round = 0; round < 100; ++round) {
+        int offset = test_flat_diff_build(&buf_each,  &diff_each,  rng);
+        test_flat_diff_build(&buf_batch, &diff_batch, rng);
+        rng.rand();
+
+        for (int step = 0; step < 20; ++step) {
+            auto& lst  = buf_each.get<Flat_array<Test_node>>(offset);
+            auto& tail = buf_each.get<Flat_array<u8>>(offset + sizeof(lst));
+
+            // Nodes added during the test have no registered array, and the arrays of removed nodes
+            // are unregistered.
+            ops.reset();
+            u64 removed = 0;
+            int count = rng.gen_uni(12) + 1;
+            for (int i = 0; i < count; ++i) {
+                u8 type = rng.gen_uni(OP_TYPE_COUNT);
+                u8 node = lst.size() ? rng.gen_uni(lst.size()) : 0;
+                u8 value = rng.gen_uni(256);
+                if (type == ADD_NODE and lst.size() + count >= 64) continue;
+                if (type == REMOVE_NODE or type == ADD_SUB or type == REMOVE_SUB) {
+                    if (lst.size() == 0) continue;
+                }
+                if (type == ADD_SUB or type == REMOVE_SUB) {
+                    if ((removed >> node & 1) or lst[node].id >= 1000) continue;
+                    if (type == ADD_SUB and lst[node].sub.size() + count >= 250) continue;
+                    if (type == REMOVE_SUB and lst[node].sub.size() == 0) continue;
+                }
+                if (type == ADD_TAIL and tail.size() + count >= 250) continue;
+                if (type == REMOVE_TAIL and tail.size() == 0) continue;
+                
+                if (type == REMOVE_NODE) removed |= 1ull << node;
+                if (type == REMOVE_SUB)  value = rng.gen_uni(lst[node].sub.size());
+                if (type == REMOVE_TAIL) value = rng.gen_uni(tail.size());
+                ops.push_back(Op {type, node, value});
+            }
+
+            auto queue = [&ops, offset](Buffer& buf, Diff_flat_arrays& diff) {
+                auto& lst  = buf.get<Flat_array<Test_node>>(offset);
+                auto& tail = buf.get<Flat_array<u8>>(offset + sizeof(lst));
+                for (Op i: ops) {
+                    switch (i.type) {
+                    case ADD_NODE:    diff.add(lst, Test_node {(u16)(1000 + i.value), {}}); break;
+                    case REMOVE_NODE: diff.remove(lst, i.node); break;
+                    case ADD_SUB:     diff.add(lst[i.node].sub, i.value); break;
+                    case REMOVE_SUB:  diff.remove(lst[i.node].sub, i.value); break;
+                    case ADD_TAIL:    diff.add(tail, i.value); break;
+                    case REMOVE_TAIL: diff.remove(tail, i.value); break;
+                    default: assert(false);
+                    }
+                }
+            };
+            queue(buf_each,  diff_each);
+            queue(buf_batch, diff_batch);
+            diff_each.apply_each();
+            diff_batch.apply();
+
+            bool same = buf_each.size() == buf_batch.size()
+                and std::memcmp(buf_each.data(), buf_batch.data(), buf_each.size()) == 0
+                and diff_each.refs().size() == diff_batch.refs().size();
+            for (int i = 0; same and i < diff_each.refs().size(); ++i) {
+                same = diff_each.refs()[i] == diff_batch.refs()[i];
+            }
+            if (not same) {
+                jerr << "Error: Diff_flat_arrays::apply differs from apply_each in round " << round
+                     << ", step " << step << '\n';
+                assert(false);
+            }
+            diff_batch.check_refs();
+        }
+    }
+    jout << "test_flat_diff_batched: ok" << endl;
+}
+
+void test_strategy_store() {
+    Rng rng;
+    Strategy_store<16> store;
+    Array<Strategy<16>> strategies;
+    Strategy<16> s;
+
+    // Build chains of strategies, each a random mutation of an earlier one, so that the chains
+    // exceed strategy_store_depth_max
+    for (int i = 0; i < 200; ++i) {
+        int base = i ? rng.gen_uni(std::min(i, 8)) + (i > 8 ? i - 8 : 0) : -1;
+        s = base == -1 ? Strategy<16> {} : strategies[base];
+        int changes = rng.gen_uni(6);
+        for (int j = 0; j < changes; ++j) {
+            Task& t = s.m_tasks[rng.gen_uni(16 * planning_max_tasks)].task;
+            t.type = rng.gen_uni(Task::VISIT + 1);
+            t.where = rng.gen_uni(256);
+            t.id = rng.gen_uni(65536);
+            t.item = {(u8)rng.gen_uni(256), (u8)rng.gen_uni(256)};
+            t.job_id = rng.gen_uni(65536);
+            t.cnt = rng.gen_uni(256);
+            t.fixer_it = rng.gen_uni(fixer_it_limit + 1);
+        }
+        s.s_id = i + 1;
+        s.task_next_id = rng.gen_uni(65536);
+        int index = store.add(s, base, base == -1 ? nullptr : &strategies[base]);
+        assert(index == i);
+        strategies.push_back(s);
+    }
+
+    for (int i = 0; i < strategies.size(); ++i) {
+        store.get(i, &s);
+        if (not (s == strategies[i]) or s.s_id != strategies[i].s_id
+            or s.task_next_id != strategies[i].task_next_id) {
+            jerr << "Error: Strategy_store returned a different strategy for " << i << '\n';
+            assert(false);
+        }
+    }
+    jout << "test_strategy_store: ok, " << store.bytes() << " bytes instead of "
+         << strategies.size() * (int)sizeof(Strategy<16>) << endl;
+}
+
+void test_action_xml(Graph* graph) {
+    init_messages();
+    set_messages_graph(graph);
+
+    // Strings with all the characters that need escaping
+    u8 agent = register_id("agentA1");
+    u8 item = register_id("item<1> & \"2\" 'x'\x01\t\r\n");
+    u16 job = register_id16("job&42");
+
+    Buffer buf;
+    Buffer direct;
+    Buffer pugi;
+    int count = 0;
+    auto check = [&](auto const& action) {
+        buf.reset();
+        buf.reserve_space(256);
+        auto& mess = buf.emplace_back<Message_Action>((u16)(count * 977), action, &buf);
+        direct.reset();
+        pugi.reset();
+        write_message(mess, &direct);
+        write_message_pugi(mess, &pugi);
+        if (direct.size() != pugi.size() or std::memcmp(direct.data(), pugi.data(), direct.size())) {
+            jerr << "Error: write_message differs from pugixml for " << Action::get_name(action.type)
+                 << ":\n" << direct.data() << "\npugixml:\n" << pugi.data() << '\n';
+            assert(false);
+        }
+        ++count;
+    };
+
+    check(Action_Goto0 {});
+    check(Action_Goto1 {item});
+    if (graph) {
+        check(Action_Goto2 {graph->get_pos(51.4712345678, -0.1234567891)});
+    }
+    check(Action_Give {agent, {item, 255}});
+    check(Action_Receive {});
+    check(Action_Store {{item, 1}});
+    check(Action_Retrieve {{item, 0}});
+    check(Action_Retrieve_delivered {{item, 17}});
+    check(Action_Assemble {item});
+    check(Action_Assist_assemble {agent});
+    check(Action_Buy {{item, 100}});
+    check(Action_Deliver_job {job});
+    check(Action_Bid_for_job {job, 4000000000u});
+    check(Action_Post_job {123456, 65535, item});
+    check(Action_Dump {{item, 3}});
+    check(Action_Charge {});
+    check(Action_Recharge {});
+    check(Action_Continue {});
+    check(Action_Skip {});
+    check(Action_Abort {});
+    check(Action_Gather {});
+
+    jout << "test_action_xml: ok, " << count << " actions" << endl;
+}
+
+void test_item_costs(Graph* graph) {
+    assert(graph);
+
+    // Item 1 is sold by a shop, item 2 only comes from a resource node, item 3 is assembled from
+    // both and item 4 from item 3
+    Buffer sim_buf;
+    sim_buf.reserve(2048);
+    auto& sim = sim_buf.emplace_back<Simulation>();
+    sim.role.tools.init(&sim_buf);
+    sim.items.init(&sim_buf);
+    for (u8 i = 1; i <= 4; ++i) {
+        sim.items.push_back(Item {i, 10}, &sim_buf);
+    }
+    for (int i = 0; i < sim.items.size(); ++i) {
+        sim.items[i].consumed.init(&sim_buf);
+        if (i == 2) { for (Item_stack j: {Item_stack {1, 1}, {2, 2}}) sim.items[i].consumed.push_back(j, &sim_buf); }
+        if (i == 3) { sim.items[i].consumed.push_back(Item_stack {3, 1}, &sim_buf); }
+        sim.items[i].tools.init(&sim_buf);
+    }
+
+    // step_init only looks at the shops
+    Buffer perc_buf;
+    perc_buf.reserve(2048);
+    auto& perc = perc_buf.emplace_back<Percept>();
+    perc.shops.init(&perc_buf);
+    perc.shops.push_back(Shop {}, &perc_buf);
+    perc.shops[0].items.init(&perc_buf);
+    perc.shops[0].items.push_back(Shop_item {{1, 5}, 40}, &perc_buf);
+
+    Buffer world_buf;
+    world_buf.emplace_back<World>(sim, graph, &world_buf);
+    world_buf.get<World>().step_init(perc, &world_buf);
+    World const& world = world_buf.get<World>();
+
+    auto check = [&world](u8 id, u16 value, u8 craftval) {
+        Item_cost const& cost = world.item_cost(id);
+        if (cost.count == 0 or cost.value() != value or cost.craftval != craftval) {
+            jerr << "Error: item " << (int)id << " has value " << (cost.count ? cost.value() : 0)
+                 << " (count " << (int)cost.count << ") and craftval " << (int)cost.craftval
+                 << " instead of " << value << " and " << (int)craftval << '\n';
+            assert(false);
+        }
+    };
+    u16 shop_value = (u16)(40 * price_shop_factor);
+    check(1, shop_value, 0);
+    check(2, price_craft_val, 1);
+    check(3, price_craft_val + shop_value + 2 * price_craft_val, 3);
+    check(4, 2 * price_craft_val + shop_value + 2 * price_craft_val, 4);
+
+    jout << "test_item_costs: ok" << endl;
+}
+
+template <int N>
+void test_fix_helpers(Simulation_state<N>* state) {
+    assert(state);
+    auto const& orig = state->orig();
+    if (orig.storages.size() == 0 or orig.shops.size() == 0 or orig.shops[0].items.size() == 0) {
+        jout << "test_fix_helpers: skipped, no storage or shop" << endl;
+        return;
+    }
+
+    // Two agents deliver an item they do not have, which a shop sells, so both need a helper
+    u8 item = orig.shops[0].items[0].id;
+    u8 agents[2];
+    int count = 0;
+    for (u8 agent = 0; agent < N and count < 2; ++agent) {
+        if (not orig.holds(agent, item)) agents[count++] = agent;
+    }
+    if (count < 2) {
+        jout << "test_fix_helpers: skipped, the item is held by everyone" << endl;
+        return;
+    }
+    Strategy<N> strategy;
+    for (int i = 0; i < 2; ++i) {
+        strategy.task(agents[i], 0).task = Task {Task::DELIVER_ITEM, orig.storages[0].id,
+            (u16)(i + 1), Item_stack {item, 1}};
+    }
+    strategy.task_next_id = 2;
+
+    state->orig().strategy = strategy;
+    state->reset();
+    state->fast_forward();
+    for (u8 agent: agents) {
+        if (state->sit().strategy.task(agent, 0).result.err != Task_result::NOT_IN_INVENTORY) {
+            jout << "test_fix_helpers: skipped, agent " << (int)agent << " did not fail" << endl;
+            return;
+        }
+    }
+
+    // Fix them as a round of fix_errors does, the second one must not get a helper whose tasks
+    // the first one changed
+    u32 touched = 0;
+    for (u8 agent: agents) {
+        if (touched >> agent & 1) break;
+        u8 other = state->fix_task(agent, 0, touched);
+        if (other != 0xff and touched >> other & 1) {
+            jerr << "Error: the fix for agent " << (int)agent << " gave tasks to agent "
+                 << (int)other << ", which an earlier fix changed already\n";
+            assert(false);
+        }
+        touched |= 1u << agent;
+        if (other != 0xff) touched |= 1u << other;
+    }
+    state->reset();
+    state->fast_forward();
+
+    // And the whole loop
+    state->orig().strategy = strategy;
+    state->fix_errors();
+    jout << "test_fix_helpers: ok" << endl;
+}
+
+template void test_fix_helpers<16>(Simulation_state<16>* state);
+template void test_fix_helpers<20>(Simulation_state<20>* state);
+template void test_fix_helpers<28>(Simulation_state<28>* state);
+
 void test_jdbg_diff() {
     {int a = 4, b = 15;
     jdbg_diff(a, b);
@@ -264,6 +600,8 @@ void Mothership_test2::init(Graph* graph_) {
     world_buffer.reset();
     sit_buffer.reset();
     sit_old_buffer.reset();
+
+    test_item_costs(graph);
 }
 
 void Mothership_test2::on_sim_start(u8 agent, Simulation const& simulation, int sim_size) {
@@ -280,8 +618,8 @@ void Mothership_test2::pre_request_action() {
 
 void Mothership_test2::pre_request_action(u8 agent, Percept const& perc, int perc_size) {
     if (agent == 0) {
-        Situation* old = sit_old_buffer.size() ? &sit_old_buffer.get<Situation>() : nullptr;
-        sit_buffer.emplace_back<Situation>(perc, old, &sit_buffer);
+        auto* old = sit_old_buffer.size() ? &sit_old_buffer.get<Situation<number_of_agents>>() : nullptr;
+        sit_buffer.emplace_back<Situation<number_of_agents>>(perc, old, &sit_buffer);
 
         // This actually only invalidates the world in the first step, unless step_init changes
         world().step_init(perc, &world_buffer);
@@ -298,7 +636,7 @@ void Mothership_test2::on_request_action() {
     sit().register_arr(&sit_diff);
     
     // Flush all the old tasks out
-    Situation* old = sit_old_buffer.size() ? &sit_old_buffer.get<Situation>() : nullptr;
+    auto* old = sit_old_buffer.size() ? &sit_old_buffer.get<Situation<number_of_agents>>() : nullptr;
     sit().flush_old(world(), *old, &sit_diff);
     sit_diff.apply();
     
@@ -363,6 +701,11 @@ void Mothership_test2::on_request_action() {
     }
 #endif
 
+    test_buffer.reset();
+    test_buffer.append(sit_buffer);
+    test_state.init(&world(), &test_buffer, 0, test_buffer.size());
+    test_fix_helpers(&test_state);
+
     crafting_plan = sit().combined_plan(world());
     //sim_state.auction_bets(&auction_bets);
     
@@ -388,7 +731,7 @@ void Mothership_test2::on_request_action() {
 }
 
 void Mothership_test2::post_request_action(u8 agent, Buffer* into) {
-    Situation* old = sit().simulation_step == 0 ? &sit() : &sit_old();
+    auto* old = sit().simulation_step == 0 ? &sit() : &sit_old();
     sit().get_action(world(), *old, agent, crafting_plan.slot(agent), &auction_bets, into);
 }
 
@@ -7,6 +7,14 @@
 namespace jup {
 
 void test_jdbg_diff();
+void test_flat_diff_batched();
+void test_strategy_store();
+void test_action_xml(Graph* graph = nullptr);
+// Check the item costs of World::step_init, including an item no shop sells
+void test_item_costs(Graph* graph);
+// Let two agents fail for lack of an item and fix both on the same simulation results
+template <int N>
+void test_fix_helpers(Simulation_state<N>* state);
     
 struct Simulation_data {
 	u8 test;
@@ -63,18 +71,21 @@ struct Mothership_test2 : Mothership {
 	void post_request_action(u8 agent, Buffer* into) override;
 
     auto& world() { return world_buffer.get<World>(0); }
-    auto& sit() { return sit_buffer.get<Situation>(0); }
-    auto& sit_old() { return sit_old_buffer.get<Situation>(0); }
+    auto& sit() { return sit_buffer.get<Situation<number_of_agents>>(0); }
+    auto& sit_old() { return sit_old_buffer.get<Situation<number_of_agents>>(0); }
     
-    Crafting_plan crafting_plan;
+    Crafting_plan<number_of_agents> crafting_plan;
     Buffer world_buffer;
     Buffer sit_buffer;
     Buffer sit_old_buffer;
     Buffer sim_buffer;
-    Simulation_state sim_state;
+    Simulation_state<number_of_agents> sim_state;
     Diff_flat_arrays sit_diff;
     Graph* graph;
     Array<Auction_bet> auction_bets;
+    // Separate from sim_state, which is kept across steps
+    Buffer test_buffer;
+    Simulation_state<number_of_agents> test_state;
 };
 
 } /* end of namespace jup */
@@ -0,0 +1,266 @@
+#include "xml_parser.hpp"
+
+namespace jup {
+
+static char const* xml_names[XML_NAME_COUNT] = {
+    "",
+    "message", "auth-response", "simulation", "sim-result", "percept", "self",
+    "team", "entity", "chargingStation", "dump", "shop", "storage", "workshop",
+    "resourceNode", "auction", "job", "mission", "posted", "item", "items",
+    "route", "action", "role", "tool", "required",
+    "type", "timestamp", "deadline", "id", "step", "name", "lat", "lon",
+    "facility", "charge", "load", "result", "amount", "money", "rate", "restock",
+    "price", "totalCapacity", "usedCapacity", "stored", "delivered", "resource",
+    "start", "end", "reward", "auctionTime", "fine", "lowestBid", "map",
+    "seedCapital", "steps", "speed", "battery", "volume", "ranking", "score"
+};
+
+/**
+ * Map a name to its id. This is an open addressing hashtable with 256 slots, which is filled on
+ * the first call.
+ */
+static u8 xml_name_id(char const* begin, char const* end) {
+    static u8 table[256];
+    static bool initialized = false;
+
+    auto hash = [](char const* begin, char const* end) {
+        // FNV-1a algorithm, same as Buffer_view::get_hash
+        u32 result = 2166136261u;
+        for (char const* i = begin; i != end; ++i) {
+            result = (result ^ (u8)*i) * 16777619u;
+        }
+        return (u8)(result ^ (result >> 8) ^ (result >> 16) ^ (result >> 24));
+    };
+
+    if (not initialized) {
+        for (u8 i = 1; i < XML_NAME_COUNT; ++i) {
+            u8 slot = hash(xml_names[i], xml_names[i] + std::strlen(xml_names[i]));
+            while (table[slot]) ++slot;
+            table[slot] = i;
+        }
+        initialized = true;
+    }
+
+    int size = end - begin;
+    for (u8 slot = hash(begin, end); table[slot]; ++slot) {
+        char const* name = xml_names[table[slot]];
+        if (std::strncmp(name, begin, size) == 0 and name[size] == 0) {
+            return table[slot];
+        }
+    }
+    return XML_UNKNOWN;
+}
+
+static bool xml_is_space(char c) {
+    return c == ' ' or c == '\t' or c == '\n' or c == '\r';
+}
+static bool xml_is_name_end(char c) {
+    return xml_is_space(c) or c == '/' or c == '>' or c == '=' or c == 0;
+}
+
+/**
+ * Decode the attribute value starting at text, which is terminated by quote. The result is written
+ * over the text and zero-terminated. Returns a pointer behind the closing quote. The escapes and
+ * the normalisation of whitespace are handled like the default options of pugixml.
+ */
+static char* xml_decode_value(char* text, char quote) {
+    char* write = text;
+    char* read = text;
+    while (*read != quote) {
+        assert(*read);
+        if (xml_is_space(*read)) {
+            *write++ = ' ';
+            ++read;
+        } else if (*read != '&') {
+            *write++ = *read++;
+        } else if (std::strncmp(read, "&lt;", 4) == 0) {
+            *write++ = '<'; read += 4;
+        } else if (std::strncmp(read, "&gt;", 4) == 0) {
+            *write++ = '>'; read += 4;
+        } else if (std::strncmp(read, "&amp;", 5) == 0) {
+            *write++ = '&'; read += 5;
+        } else if (std::strncmp(read, "&quot;", 6) == 0) {
+            *write++ = '"'; read += 6;
+        } else if (std::strncmp(read, "&apos;", 6) == 0) {
+            *write++ = '\''; read += 6;
+        } else if (read[1] == '#') {
+            // Only ASCII characters are decoded, the server does not send anything else
+            bool hex = read[2] == 'x';
+            char* end;
+            long code = std::strtol(read + 2 + hex, &end, hex ? 16 : 10);
+            if (*end == ';' and 0 < code and code < 128) {
+                *write++ = (char)code;
+                read = end + 1;
+            } else {
+                *write++ = *read++;
+            }
+        } else {
+            *write++ = *read++;
+        }
+    }
+    *write = 0;
+    return read + 1;
+}
+
+// see header
+void Xml_parser::parse(char* text) {
+    assert(text);
+    nodes.reset();
+    attrs.reset();
+    stack.reset();
+
+    char* p = text;
+    while (*p) {
+        if (*p != '<') {
+            // Text content is not used by the protocol
+            ++p;
+            continue;
+        }
+        ++p;
+
+        if (*p == '?') {
+            p = std::strstr(p, "?>");
+            assert(p);
+            p += 2;
+        } else if (*p == '!') {
+            p = std::strncmp(p, "!--", 3) == 0 ? std::strstr(p, "-->") : std::strchr(p, '>');
+            assert(p);
+            ++p;
+        } else if (*p == '/') {
+            assert(stack.size() >= 2);
+            stack.addsize(-2);
+            p = std::strchr(p, '>');
+            assert(p);
+            ++p;
+        } else {
+            char* name = p;
+            while (not xml_is_name_end(*p)) ++p;
+
+            int index = nodes.size();
+            auto& node = nodes.emplace_back();
+            node.name = xml_name_id(name, p);
+            node.attr_count = 0;
+            node.attr_first = attrs.size();
+            node.first_child = -1;
+            node.next_sibling = -1;
+
+            if (stack.size()) {
+                int& last = stack.back();
+                if (last == -1) {
+                    nodes[stack[stack.size() - 2]].first_child = index;
+                } else {
+                    nodes[last].next_sibling = index;
+                }
+                last = index;
+            } else {
+                // Only one root element is supported
+                assert(index == 0);
+            }
+
+            while (true) {
+                while (xml_is_space(*p)) ++p;
+                if (*p == '/') {
+                    assert(p[1] == '>');
+                    p += 2;
+                    break;
+                } else if (*p == '>') {
+                    stack.push_back(index);
+                    stack.push_back(-1);
+                    ++p;
+                    break;
+                }
+
+                char* attr_name = p;
+                while (not xml_is_name_end(*p)) ++p;
+                char* attr_name_end = p;
+                while (xml_is_space(*p)) ++p;
+                assert(*p == '=');
+                ++p;
+                while (xml_is_space(*p)) ++p;
+                assert(*p == '"' or *p == '\'');
+
+                auto& attr = attrs.emplace_back();
+                attr.name = xml_name_id(attr_name, attr_name_end);
+                attr.value = p + 1;
+                p = xml_decode_value(p + 1, *p);
+                assert(nodes[index].attr_count < 255);
+                ++nodes[index].attr_count;
+            }
+        }
+    }
+    assert(stack.size() == 0 and nodes.size());
+}
+
+// see header
+char const* Xml_parser::attr(int index, u8 name) const {
+    if (index == -1) return "";
+    Node const& n = node(index);
+    for (int i = n.attr_first; i < n.attr_first + n.attr_count; ++i) {
+        if (attrs.data()[i].name == name) return attrs.data()[i].value;
+    }
+    return "";
+}
+
+/**
+ * Convert the string to an integer the same way as pugixml, including the handling of overflow.
+ */
+template <typename U>
+static U xml_string_to_integer(char const* s, U minneg, U maxpos) {
+    U result = 0;
+    while (xml_is_space(*s)) ++s;
+
+    bool negative = *s == '-';
+    s += *s == '+' or *s == '-';
+
+    bool overflow;
+    if (s[0] == '0' and (s[1] | ' ') == 'x') {
+        s += 2;
+        while (*s == '0') ++s;
+        char const* start = s;
+        while (true) {
+            if ((unsigned)(*s - '0') < 10) {
+                result = result * 16 + (*s - '0');
+            } else if ((unsigned)((*s | ' ') - 'a') < 6) {
+                result = result * 16 + ((*s | ' ') - 'a' + 10);
+            } else {
+                break;
+            }
+            ++s;
+        }
+        overflow = (size_t)(s - start) > sizeof(U) * 2;
+    } else {
+        while (*s == '0') ++s;
+        char const* start = s;
+        while ((unsigned)(*s - '0') < 10) {
+            result = result * 10 + (*s - '0');
+            ++s;
+        }
+        size_t digits = s - start;
+        size_t max_digits = sizeof(U) == 8 ? 20 : 10;
+        char max_lead = sizeof(U) == 8 ? '1' : '4';
+        size_t high_bit = sizeof(U) * 8 - 1;
+        overflow = digits >= max_digits and not (digits == max_digits
+            and (*start < max_lead or (*start == max_lead and result >> high_bit)));
+    }
+
+    if (negative) {
+        return overflow or result > minneg ? 0 - minneg : 0 - result;
+    } else {
+        return overflow or result > maxpos ? maxpos : result;
+    }
+}
+
+// see header
+int Xml_parser::attr_int(int index, u8 name) const {
+    using L = std::numeric_limits<int>;
+    return (int)xml_string_to_integer<unsigned>(attr(index, name), 0 - (unsigned)L::min(), L::max());
+}
+u64 Xml_parser::attr_ullong(int index, u8 name) const {
+    using U = unsigned long long;
+    return xml_string_to_integer<U>(attr(index, name), 0, std::numeric_limits<U>::max());
+}
+double Xml_parser::attr_double(int index, u8 name) const {
+    return std::strtod(attr(index, name), nullptr);
+}
+
+} /* end of namespace jup */
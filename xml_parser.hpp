@@ -0,0 +1,85 @@
+#pragma once
+
+#include "array.hpp"
+#include "buffer.hpp"
+
+namespace jup {
+
+/**
+ * The tag and attribute names of the MASSim protocol. Other names are parsed as XML_UNKNOWN. Names
+ * that are used both for tags and attributes (like team) only have one id.
+ */
+enum Xml_name: u8 {
+    XML_UNKNOWN = 0,
+    XML_MESSAGE, XML_AUTH_RESPONSE, XML_SIMULATION, XML_SIM_RESULT, XML_PERCEPT, XML_SELF,
+    XML_TEAM, XML_ENTITY, XML_CHARGING_STATION, XML_DUMP, XML_SHOP, XML_STORAGE, XML_WORKSHOP,
+    XML_RESOURCE_NODE, XML_AUCTION, XML_JOB, XML_MISSION, XML_POSTED, XML_ITEM, XML_ITEMS,
+    XML_ROUTE, XML_ACTION, XML_ROLE, XML_TOOL, XML_REQUIRED,
+    XML_TYPE, XML_TIMESTAMP, XML_DEADLINE, XML_ID, XML_STEP, XML_NAME, XML_LAT, XML_LON,
+    XML_FACILITY, XML_CHARGE, XML_LOAD, XML_RESULT, XML_AMOUNT, XML_MONEY, XML_RATE, XML_RESTOCK,
+    XML_PRICE, XML_TOTAL_CAPACITY, XML_USED_CAPACITY, XML_STORED, XML_DELIVERED, XML_RESOURCE,
+    XML_START, XML_END, XML_REWARD, XML_AUCTION_TIME, XML_FINE, XML_LOWEST_BID, XML_MAP,
+    XML_SEED_CAPITAL, XML_STEPS, XML_SPEED, XML_BATTERY, XML_VOLUME, XML_RANKING, XML_SCORE,
+    XML_NAME_COUNT
+};
+
+/**
+ * A parser for the xml messages of the server, as a replacement for pugixml. The text is read in a
+ * single pass, which records the elements and attributes in flat arrays. Attribute values are
+ * decoded in place and zero-terminated, so the text must stay alive while they are used. The
+ * arrays are kept between messages, so that no memory is allocated once they are large enough.
+ *
+ * Only what the server sends is supported: elements, attributes, the xml declaration and
+ * comments. Text content is skipped.
+ */
+struct Xml_parser {
+    struct Attr {
+        u8 name;
+        char const* value;
+    };
+    struct Node {
+        u8 name;
+        u8 attr_count;
+        int attr_first;
+        int first_child;
+        int next_sibling;
+    };
+
+    Array<Node> nodes;
+    Array<Attr> attrs;
+    // The open elements and their last child, only used during parse
+    Array<int> stack;
+
+    // Parse the zero-terminated text, which is modified. Afterwards, node 0 is the root element.
+    void parse(char* text);
+
+    Node const& node(int index) const { return nodes.data()[index]; }
+
+    // Return the first child of node with the given name, or the next sibling with that name,
+    // respectively. These are -1 if there is none. Like in pugixml, index may be -1.
+    int child(int index, u8 name) const {
+        if (index == -1) return -1;
+        int i = node(index).first_child;
+        while (i != -1 and node(i).name != name) i = node(i).next_sibling;
+        return i;
+    }
+    int next(int index, u8 name) const {
+        int i = node(index).next_sibling;
+        while (i != -1 and node(i).name != name) i = node(i).next_sibling;
+        return i;
+    }
+    int count(int index, u8 name) const {
+        int result = 0;
+        for (int i = child(index, name); i != -1; i = next(i, name)) ++result;
+        return result;
+    }
+
+    // The value of an attribute of node, the empty string if it does not exist. Numbers are
+    // converted like pugixml does.
+    char const* attr(int index, u8 name) const;
+    int attr_int(int index, u8 name) const;
+    u64 attr_ullong(int index, u8 name) const;
+    double attr_double(int index, u8 name) const;
+};
+
+} /* end of namespace jup */